@@ -79,6 +79,10 @@ __FBSDID("$FreeBSD$");
 
 #include <vm/uma.h>
 
+#ifdef FSTACK
+#include "ff_host_interface.h"
+#endif
+
 static MALLOC_DEFINE(M_KQUEUE, "kqueue", "memory for kqueue system");
 
 /*
@@ -1510,6 +1514,13 @@ findkn:
 	/*
 	 * kn now contains the matching knote, or NULL if no match
 	 */
+#ifdef FSTACK
+	if (kev->ext[3] == ff_KEV_EPOLL_PROBE) {
+		KQ_UNLOCK(kq);
+		error = kn == NULL ? ENOENT : 0;
+		goto done;
+	}
+#endif
 	if (kn == NULL) {
 		if (kev->flags & EV_ADD) {
 			kn = tkn;
@@ -1589,6 +1600,13 @@ findkn:
 	KQ_UNLOCK(kq);
 	knl = kn_list_lock(kn);
 	kn->kn_kevent.udata = kev->udata;
+#ifdef FSTACK
+	if (kev->ext[3] == ff_KEV_EPOLL_MOD) {
+		kn->kn_flags = (kn->kn_flags & ~(EV_CLEAR | EV_DISPATCH)) |
+		    (kev->flags & (EV_CLEAR | EV_DISPATCH));
+		kn->kn_kevent.ext[2] = kev->ext[2];
+	}
+#endif
 	if (!fops->f_isfd && fops->f_touch != NULL) {
 		fops->f_touch(kn, kev, EVENT_REGISTER);
 	} else {
@@ -2211,6 +2229,10 @@ kqueue_wakeup(struct kqueue *kq)
 {
 	KQ_OWNED(kq);
 
+#ifdef FSTACK
+	ff_loop_wakeup();
+#endif
+
 	if ((kq->kq_state & KQ_SLEEP) == KQ_SLEEP) {
 		kq->kq_state &= ~KQ_SLEEP;
 		wakeup(kq);
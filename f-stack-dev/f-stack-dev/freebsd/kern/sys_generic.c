@@ -78,6 +78,10 @@ __FBSDID("$FreeBSD$");
 
 #include <security/audit/audit.h>
 
+#ifdef FSTACK
+#include "ff_host_interface.h"
+#endif
+
 /*
  * The following macro defines how many bytes will be allocated from
  * the stack instead of memory allocated when passing the IOCTL data
@@ -1854,6 +1858,14 @@ doselwakeup(struct selinfo *sip, int pri)
 	struct selfd *sfn;
 	struct seltd *stp;
 
+#ifdef FSTACK
+	/*
+	 * Every socket, listening ones included, notifies its pollers
+	 * here; end the wait of the loop sleeping on their behalf.
+	 */
+	ff_loop_wakeup();
+#endif
+
 	/* If it's not initialized there can't be any waiters. */
 	if (sip->si_mtx == NULL)
 		return;
@@ -77,6 +77,10 @@ __FBSDID("$FreeBSD$");
 
 #include <security/mac/mac_framework.h>
 
+#ifdef FSTACK
+#include "ff_host_interface.h"
+#endif
+
 #define SIN(s) ((const struct sockaddr_in *)(s))
 
 static struct timeval arp_lastlog;
@@ -188,6 +192,9 @@ static void	in_arpinput(struct mbuf *);
 static void arp_check_update_lle(struct arphdr *ah, struct in_addr isaddr,
     struct ifnet *ifp, int bridged, struct llentry *la);
 static void arp_mark_lle_reachable(struct llentry *la);
+#ifdef FSTACK
+static int arp_lle_from_shared(struct ifnet *ifp, struct llentry *la);
+#endif
 static void arp_iflladdr(void *arg __unused, struct ifnet *ifp);
 
 static eventhandler_tag iflladdr_tag;
@@ -520,6 +527,15 @@ arpresolve_full(struct ifnet *ifp, int is_gw, int flags, struct mbuf *m,
 		return (EINVAL);
 	}
 
+#ifdef FSTACK
+	if ((la->la_flags & (LLE_VALID | LLE_STATIC)) == 0 &&
+	    la->la_hold == NULL && arp_lle_from_shared(ifp, la) != 0) {
+		/* @la was deleted while being filled */
+		m_freem(m);
+		return (EWOULDBLOCK);
+	}
+#endif
+
 	if ((la->la_flags & LLE_VALID) &&
 	    ((la->la_flags & LLE_STATIC) || la->la_expire > time_uptime)) {
 		if (flags & LLE_ADDRONLY) {
@@ -1281,8 +1297,63 @@ arp_mark_lle_reachable(struct llentry *la)
 	}
 	la->la_asked = 0;
 	la->la_preempt = V_arp_maxtries;
+#ifdef FSTACK
+	if (!(la->la_flags & LLE_IFADDR))
+		ff_neigh_update(la->lle_tbl->llt_ifp->if_softc,
+		    &la->r_l3addr.addr4, sizeof(struct in_addr), la->ll_addr);
+#endif
 }
 
+#ifdef FSTACK
+/*
+ * Fills unresolved @la from the neighbor cache shared with the other
+ * f-stack processes, keeping the expiry the entry has there.
+ * Returns ENOENT if @la was deleted meanwhile, 0 otherwise.
+ */
+static int
+arp_lle_from_shared(struct ifnet *ifp, struct llentry *la)
+{
+	char lladdr[ETHER_ADDR_LEN];
+	char linkhdr[LLE_MAX_LINKHDR];
+	size_t linkhdrsize;
+	int lladdr_off, canceled, keep, wtime;
+	uint32_t age;
+
+	LLE_WLOCK_ASSERT(la);
+
+	if (ifp->if_addrlen != ETHER_ADDR_LEN ||
+	    ff_neigh_lookup(ifp->if_softc, &la->r_l3addr.addr4,
+	    sizeof(struct in_addr), lladdr, &age) != 0 ||
+	    age >= V_arpt_keep)
+		return (0);
+
+	linkhdrsize = sizeof(linkhdr);
+	if (lltable_calc_llheader(ifp, AF_INET, lladdr, linkhdr,
+	    &linkhdrsize, &lladdr_off) != 0)
+		return (0);
+	if (lltable_try_set_entry_addr(ifp, la, linkhdr, linkhdrsize,
+	    lladdr_off) == 0)
+		return (ENOENT);
+
+	la->ln_state = ARP_LLINFO_REACHABLE;
+	EVENTHANDLER_INVOKE(lle_event, la, LLENTRY_RESOLVED);
+
+	LLE_ADDREF(la);
+	keep = V_arpt_keep - age;
+	la->la_expire = time_uptime + keep;
+	wtime = keep - V_arp_maxtries * V_arpt_rexmit;
+	if (wtime <= 0)
+		wtime = keep;
+	canceled = callout_reset(&la->lle_timer, hz * wtime, arptimer, la);
+	if (canceled)
+		LLE_REMREF(la);
+	la->la_asked = 0;
+	la->la_preempt = V_arp_maxtries;
+
+	return (0);
+}
+#endif
+
 /*
  * Add permanent link-layer record for given interface address.
  */
@@ -679,9 +679,26 @@ in_pcbbind(struct inpcb *inp, struct sockaddr *nam, struct ucred *cred)
  * that is unused with those, otherwise one that is completely unused.
  * lsa can be NULL for IPv6.
  */
+#ifdef FSTACK
+/*
+ * With rss set, only ports whose reply traffic (faddr:fport -> lsa:lport)
+ * hashes to our RSS queue are candidates, see in_pcbconnect_setup().
+ */
+struct ff_lport_rss {
+	void *softc;
+	struct in_addr faddr;
+	u_short fport;
+};
+
+static int
+in_pcb_lport_dest_rss(struct inpcb *inp, struct sockaddr *lsa,
+    u_short *lportp, struct sockaddr *fsa, u_short fport, struct ucred *cred,
+    int lookupflags, const struct ff_lport_rss *rss)
+#else
 int
 in_pcb_lport_dest(struct inpcb *inp, struct sockaddr *lsa, u_short *lportp,
     struct sockaddr *fsa, u_short fport, struct ucred *cred, int lookupflags)
+#endif
 {
 	struct inpcbinfo *pcbinfo;
 	struct inpcb *tmpinp;
@@ -787,6 +804,16 @@ in_pcb_lport_dest(struct inpcb *inp, struct sockaddr *lsa, u_short *lportp,
 			*lastport = first;
 		lport = htons(*lastport);
 
+#ifdef FSTACK
+		/* The hash is much cheaper than the pcb lookup, check it first */
+		if (rss != NULL && !ff_rss_check(rss->softc, rss->faddr.s_addr,
+		    ((struct sockaddr_in *)lsa)->sin_addr.s_addr, rss->fport,
+		    lport)) {
+			tmpinp = inp;
+			continue;
+		}
+#endif
+
 		if (fsa != NULL) {
 #ifdef INET
 			if (lsa->sa_family == AF_INET) {
@@ -823,6 +850,17 @@ in_pcb_lport_dest(struct inpcb *inp, struct sockaddr *lsa, u_short *lportp,
 	return (0);
 }
 
+#ifdef FSTACK
+int
+in_pcb_lport_dest(struct inpcb *inp, struct sockaddr *lsa, u_short *lportp,
+    struct sockaddr *fsa, u_short fport, struct ucred *cred, int lookupflags)
+{
+
+	return (in_pcb_lport_dest_rss(inp, lsa, lportp, fsa, fport, cred,
+	    lookupflags, NULL));
+}
+#endif
+
 /*
  * Select a local port (number) to use.
  */
@@ -1492,8 +1530,9 @@ in_pcbconnect_setup(struct inpcb *inp, struct sockaddr *nam,
 #else
 		struct ifaddr *ifa;
 		struct ifnet *ifp;
-		struct sockaddr_in ifp_sin;
-		unsigned loop_count = 0;
+		struct sockaddr_in ifp_sin, lsin;
+		struct ff_lport_rss rss;
+		int lookupflags = 0;
 		bzero(&ifp_sin, sizeof(ifp_sin));
 		ifp_sin.sin_addr.s_addr = laddr.s_addr;
 		ifp_sin.sin_family = AF_INET;
@@ -1506,27 +1545,30 @@ in_pcbconnect_setup(struct inpcb *inp, struct sockaddr *nam,
 				return (EADDRNOTAVAIL);
 		}
 		ifp = ifa->ifa_ifp;
-		while (lport == 0) {
-			int rss;
-			error = in_pcbbind_setup(inp, NULL, &laddr.s_addr, &lport,
-			    cred);
-			if (error)
-				return (error);
-			rss = ff_rss_check(ifp->if_softc, faddr.s_addr, laddr.s_addr,
-			    fport, lport);
-			if (rss) {
-				break;
-			}
-			lport = 0;
-			/* Note:
-			 * if all ports are completely used, just return.
-			 * this ugly code is not a correct way, it just lets loop quit.
-			 * we will fix it as soon as possible.
-			*/
-			if (++loop_count >= 65535) {
-				return (EADDRNOTAVAIL);
-			}
-		}
+
+		/*
+		 * Same as in_pcbbind_setup() without a name, but in one pass
+		 * over the ephemeral range which skips the ports steered to
+		 * other queues before looking them up.
+		 */
+		if (CK_STAILQ_EMPTY(&V_in_ifaddrhead))
+			return (EADDRNOTAVAIL);
+		if ((error = prison_local_ip4(cred, &laddr)) != 0)
+			return (error);
+		if ((inp->inp_socket->so_options &
+		    (SO_REUSEADDR|SO_REUSEPORT|SO_REUSEPORT_LB)) == 0)
+			lookupflags = INPLOOKUP_WILDCARD;
+
+		bzero(&lsin, sizeof(lsin));
+		lsin.sin_family = AF_INET;
+		lsin.sin_addr = laddr;
+		rss.softc = ifp->if_softc;
+		rss.faddr = faddr;
+		rss.fport = fport;
+		error = in_pcb_lport_dest_rss(inp, (struct sockaddr *)&lsin,
+		    &lport, NULL, 0, cred, lookupflags, &rss);
+		if (error)
+			return (error);
 #endif
 	}
 	*laddrp = laddr.s_addr;
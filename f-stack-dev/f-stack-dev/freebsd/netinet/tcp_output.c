@@ -105,6 +105,10 @@ __FBSDID("$FreeBSD$");
 
 #include <security/mac/mac_framework.h>
 
+#ifdef FSTACK
+#include "ff_host_interface.h"
+#endif
+
 VNET_DEFINE(int, path_mtu_discovery) = 1;
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, path_mtu_discovery, CTLFLAG_VNET | CTLFLAG_RW,
 	&VNET_NAME(path_mtu_discovery), 1,
@@ -563,6 +567,19 @@ after_sack_rexmit:
 	    ipoptlen == 0 && !(flags & TH_SYN))
 		tso = 1;
 
+#ifdef FSTACK
+	/*
+	 * While short of packet buffers retransmit one segment per call,
+	 * the ACKs clock out the rest instead of a burst that can't be
+	 * buffered.
+	 */
+	if ((sack_rxmit || SEQ_LT(tp->snd_nxt, tp->snd_max)) &&
+	    ff_mbuf_pressure()) {
+		dont_sendalot = 1;
+		tso = 0;
+	}
+#endif
+
 	if (sack_rxmit) {
 		if (SEQ_LT(p->rxmit + len, tp->snd_una + sbused(&so->so_snd)))
 			flags &= ~TH_FIN;
@@ -1701,6 +1718,10 @@ timer:
 	 */
 	if (sendalot && --maxburst)
 		goto again;
+#endif
+#ifdef FSTACK
+	if (dont_sendalot)
+		sendalot = 0;
 #endif
 	if (sendalot)
 		goto again;
@@ -2121,6 +2142,10 @@ tcp_sndbuf_autoscale(struct tcpcb *tp, struct socket *so, uint32_t sendwin)
 		    sbused(&so->so_snd) >=
 		    (so->so_snd.sb_hiwat / 8 * 7) - lowat &&
 		    sbused(&so->so_snd) < V_tcp_autosndbuf_max &&
+#ifdef FSTACK
+		    /* Don't grow while short of packet buffers. */
+		    !ff_mbuf_pressure() &&
+#endif
 		    sendwin >= (sbused(&so->so_snd) -
 		    (tp->snd_nxt - tp->snd_una))) {
 			if (!sbreserve_locked(&so->so_snd,
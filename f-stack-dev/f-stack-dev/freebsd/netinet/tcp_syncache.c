@@ -103,6 +103,10 @@ __FBSDID("$FreeBSD$");
 
 #include <security/mac/mac_framework.h>
 
+#ifdef FSTACK
+#include "ff_host_interface.h"
+#endif
+
 VNET_DEFINE_STATIC(int, tcp_syncookies) = 1;
 #define	V_tcp_syncookies		VNET(tcp_syncookies)
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, syncookies, CTLFLAG_VNET | CTLFLAG_RW,
@@ -551,6 +555,11 @@ static inline bool
 syncache_cookiesonly(void)
 {
 
+#ifdef FSTACK
+	/* Keep no state for new connections while short of packet buffers. */
+	if (V_tcp_syncookies && ff_mbuf_pressure())
+		return (true);
+#endif
 	return (V_tcp_syncookies && (V_tcp_syncache.paused ||
 	    V_tcp_syncookiesonly));
 }
@@ -84,6 +84,10 @@ __FBSDID("$FreeBSD$");
 
 #include <security/mac/mac_framework.h>
 
+#ifdef FSTACK
+#include "ff_host_interface.h"
+#endif
+
 #define ND6_SLOWTIMER_INTERVAL (60 * 60) /* 1 hour */
 #define ND6_RECALC_REACHTM_INTERVAL (60 * 120) /* 2 hours */
 
@@ -138,6 +142,9 @@ static void nd6_free(struct llentry **, int);
 static void nd6_free_redirect(const struct llentry *);
 static void nd6_llinfo_timer(void *);
 static void nd6_llinfo_settimer_locked(struct llentry *, long);
+#ifdef FSTACK
+static int nd6_lle_from_shared(struct ifnet *, struct llentry *);
+#endif
 static void clear_llinfo_pqueue(struct llentry *);
 static int nd6_resolve_slow(struct ifnet *, int, struct mbuf *,
     const struct sockaddr_in6 *, u_char *, uint32_t *, struct llentry **);
@@ -700,6 +707,12 @@ nd6_llinfo_setstate(struct llentry *lle, int newstate)
 			ifp = lle->lle_tbl->llt_ifp;
 			delay = (long)ND_IFINFO(ifp)->reachable * hz;
 		}
+#ifdef FSTACK
+		if ((lle->la_flags & (LLE_VALID | LLE_IFADDR)) == LLE_VALID)
+			ff_neigh_update(lle->lle_tbl->llt_ifp->if_softc,
+			    &lle->r_l3addr.addr6, sizeof(struct in6_addr),
+			    lle->ll_addr);
+#endif
 		break;
 	case ND6_LLINFO_STALE:
 
@@ -729,6 +742,45 @@ nd6_llinfo_setstate(struct llentry *lle, int newstate)
 	lle->ln_state = newstate;
 }
 
+#ifdef FSTACK
+/*
+ * Fills unresolved @lle from the neighbor cache shared with the other
+ * f-stack processes. The entry starts STALE, so that the neighbor is
+ * probed by unicast before it is trusted.
+ * Returns ENOENT if @lle was deleted meanwhile, 0 otherwise.
+ */
+static int
+nd6_lle_from_shared(struct ifnet *ifp, struct llentry *lle)
+{
+	char lladdr[ETHER_ADDR_LEN];
+	char linkhdr[LLE_MAX_LINKHDR];
+	size_t linkhdrsize;
+	int lladdr_off;
+	uint32_t age;
+
+	LLE_WLOCK_ASSERT(lle);
+
+	if (ifp->if_addrlen != ETHER_ADDR_LEN ||
+	    ff_neigh_lookup(ifp->if_softc, &lle->r_l3addr.addr6,
+	    sizeof(struct in6_addr), lladdr, &age) != 0 ||
+	    age >= ND_IFINFO(ifp)->reachable)
+		return (0);
+
+	linkhdrsize = sizeof(linkhdr);
+	if (lltable_calc_llheader(ifp, AF_INET6, lladdr, linkhdr,
+	    &linkhdrsize, &lladdr_off) != 0)
+		return (0);
+	if (lltable_try_set_entry_addr(ifp, lle, linkhdr, linkhdrsize,
+	    lladdr_off) == 0)
+		return (ENOENT);
+
+	nd6_llinfo_setstate(lle, ND6_LLINFO_STALE);
+	EVENTHANDLER_INVOKE(lle_event, lle, LLENTRY_RESOLVED);
+
+	return (0);
+}
+#endif
+
 /*
  * Timer-dependent part of nd state machine.
  *
@@ -2340,6 +2392,16 @@ nd6_resolve_slow(struct ifnet *ifp, int flags, struct mbuf *m,
 
 	LLE_WLOCK_ASSERT(lle);
 
+#ifdef FSTACK
+	if (lle->ln_state <= ND6_LLINFO_INCOMPLETE &&
+	    (lle->la_flags & LLE_VALID) == 0 && lle->la_hold == NULL &&
+	    nd6_lle_from_shared(ifp, lle) != 0) {
+		/* lle was deleted while being filled */
+		m_freem(m);
+		return (EWOULDBLOCK);
+	}
+#endif
+
 	/*
 	 * The first time we send a packet to a neighbor whose entry is
 	 * STALE, we have to change the state to DELAY and a sets a timer to
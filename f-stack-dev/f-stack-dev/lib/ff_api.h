@@ -114,6 +114,25 @@ ssize_t ff_readv(int fd, const struct iovec *iov, int iovcnt);
 ssize_t ff_write(int fd, const void *buf, size_t nbytes);
 ssize_t ff_writev(int fd, const struct iovec *iov, int iovcnt);
 
+/*
+ * Batched readv/writev over many fds in one call, the per call overhead
+ * (thread lookup, errno translation, etc.) is paid once per batch.
+ *
+ * Each entry gets its own result in `ret`, -1 with `error` set to the errno
+ * if it failed, a failed entry doesn't stop the following ones.
+ * Return the number of entries that succeeded.
+ */
+struct ff_iovec_batch {
+    int fd;
+    const struct iovec *iov;
+    int iovcnt;
+    ssize_t ret;
+    int error;
+};
+
+int ff_readv_batch(struct ff_iovec_batch *vec, int n);
+int ff_writev_batch(struct ff_iovec_batch *vec, int n);
+
 ssize_t ff_send(int s, const void *buf, size_t len, int flags);
 ssize_t ff_sendto(int s, const void *buf, size_t len, int flags,
     const struct linux_sockaddr *to, socklen_t tolen);
@@ -124,9 +143,34 @@ ssize_t ff_recvfrom(int s, void *buf, size_t len, int flags,
     struct linux_sockaddr *from, socklen_t *fromlen);
 ssize_t ff_recvmsg(int s, struct msghdr *msg, int flags);
 
+/*
+ * Same layout as `struct mmsghdr` of linux.
+ */
+struct ff_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+/*
+ * Send/receive many datagrams on one socket with one lookup of the socket,
+ * the semantics are the same as sendmmsg(2)/recvmmsg(2) of linux:
+ * the number of messages transferred is returned and `msg_len` of each is set,
+ * -1 is only returned if the first message fails.
+ * `vlen` is capped to 1024, MSG_WAITFORONE is supported by ff_recvmmsg.
+ */
+int ff_sendmmsg(int s, struct ff_mmsghdr *msgvec, unsigned int vlen,
+    int flags);
+int ff_recvmmsg(int s, struct ff_mmsghdr *msgvec, unsigned int vlen,
+    int flags, struct timespec *timeout);
+
 int ff_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
     struct timeval *timeout);
 
+/*
+ * ff_poll/ff_kevent/ff_epoll_wait never block, with `loop_wait` enabled in
+ * config.ini, a call that returns no events holds the loop callback back
+ * until an event is queued or `timeout` expires.
+ */
 int ff_poll(struct pollfd fds[], nfds_t nfds, int timeout);
 
 int ff_kqueue(void);
@@ -203,6 +247,31 @@ typedef int (*dispatch_func_t)(void *data, uint16_t *len,
 /* regist a packet dispath function */
 void ff_regist_packet_dispatcher(dispatch_func_t func);
 
+/*
+ * Burst packet dispatch callback function.
+ * Implemented by user, called once per rx burst with all its packets,
+ * takes precedence over dispatch_func_t when both are registered.
+ *
+ * @param data
+ *   The data pointers of the packets.
+ * @param len
+ *   The lengths of the packets.
+ * @param queues
+ *   Output, per packet, same values as returned by dispatch_func_t.
+ * @param count
+ *   Number of packets.
+ * @param queue_id
+ *   Current queue of these packets.
+ * @param nb_queues
+ *   Number of queues to be dispatched.
+ *
+ */
+typedef void (*dispatch_burst_func_t)(void **data, uint16_t *len,
+    int *queues, uint16_t count, uint16_t queue_id, uint16_t nb_queues);
+
+/* regist a burst packet dispath function */
+void ff_regist_packet_burst_dispatcher(dispatch_burst_func_t func);
+
 /* dispatch api end */
 
 /* pcb lddr api begin */
@@ -316,10 +385,53 @@ int ff_zc_mbuf_get(struct ff_zc_mbuf *m, int len);
 int ff_zc_mbuf_write(struct ff_zc_mbuf *m, const char *data, int len);
 
 /*
- * Read data to the mbuf chain in 'sturct ff_zc_mbuf'.
- * not implemented now.
+ * Receive data from socket without copying it.
+ * The data is handed over as the mbuf chain taken out of the socket buffer,
+ * and stays referenced by 'struct ff_zc_mbuf' until 'ff_zc_mbuf_free'.
+ *
+ * Get the data with 'ff_zc_mbuf_read', or if built with FF_ZC_SEND,
+ * pass 'bsd_mbuf' of 'struct ff_zc_mbuf' to 'ff_write' to forward it
+ * unread without any copy, 'ff_write' then owns the mbuf chain and
+ * 'ff_zc_mbuf_free' mustn't be called.
+ *
+ * @param s
+ *   The socket to receive from.
+ * @param m
+ *   The ponitor of 'sturct ff_zc_mbuf', and can't be NULL.
+ * @param len
+ *   The max len to receive.
+ * @param flags
+ *   The same as 'ff_recv'.
+ *
+ * @return
+ *   The received len, 0 means EOF.
+ *  -1 means error, and errno is set.
+ */
+ssize_t ff_zc_recv(int s, struct ff_zc_mbuf *m, size_t len, int flags);
+
+/*
+ * Read the data received by 'ff_zc_recv' from the mbuf chain in 'sturct ff_zc_mbuf'.
+ * Each call returns the next read-only segment, at most len bytes,
+ * pointing into the packet buffer, no data is copied.
+ * The segment stays valid until 'ff_zc_mbuf_free'.
+ *
+ * @param m
+ *   The ponitor of 'sturct ff_zc_mbuf', filled by 'ff_zc_recv'.
+ * @param data
+ *   Set to the start of the segment.
+ * @param len
+ *   The max len that APP want to read this time.
+ *
+ * @return
+ *   The len of the segment, 0 means all data has been read.
+ *  -1 means error.
+ */
+int ff_zc_mbuf_read(struct ff_zc_mbuf *m, const char **data, int len);
+
+/*
+ * Release the mbuf chain received by 'ff_zc_recv'.
  */
-int ff_zc_mbuf_read(struct ff_zc_mbuf *m, const char *data, int len);
+void ff_zc_mbuf_free(struct ff_zc_mbuf *m);
 
 /* ZERO COPY API end */
 
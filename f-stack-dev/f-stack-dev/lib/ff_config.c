@@ -343,6 +343,25 @@ parse_port_list(struct ff_config *cfg, const char *v_str)
     return res;
 }
 
+static int
+parse_port_power_mode(struct ff_port_cfg *cfg, const char *v_str)
+{
+    if (strcasecmp(v_str, "busy") == 0) {
+        cfg->power_mode = FF_POWER_BUSY;
+    } else if (strcasecmp(v_str, "backoff") == 0) {
+        cfg->power_mode = FF_POWER_BACKOFF;
+    } else if (strcasecmp(v_str, "monitor") == 0) {
+        cfg->power_mode = FF_POWER_MONITOR;
+    } else if (strcasecmp(v_str, "interrupt") == 0) {
+        cfg->power_mode = FF_POWER_INTERRUPT;
+    } else {
+        fprintf(stderr, "unknown power_mode %s of %s\n", v_str, cfg->name);
+        return 0;
+    }
+
+    return 1;
+}
+
 static int
 parse_port_slave_list(struct ff_port_cfg *cfg, const char *v_str)
 {
@@ -442,6 +461,50 @@ fail:
 }
 #endif
 
+static int
+mbuf_pool_cmp(const void *a, const void *b)
+{
+    return ((const struct ff_mbuf_pool_cfg *)a)->data_size -
+        ((const struct ff_mbuf_pool_cfg *)b)->data_size;
+}
+
+/* <data size>[:<mbufs>],... e.g. 256:65536,9216:16384 */
+static int
+parse_mbuf_pools(struct ff_config *cfg, const char *value)
+{
+    char input[256], *tok, *save;
+    struct ff_mbuf_pool_cfg *pc;
+    unsigned size, count;
+    int n = 0;
+
+    strncpy(input, value, sizeof(input) - 1);
+    input[sizeof(input) - 1] = '\0';
+
+    for (tok = strtok_r(input, ",", &save); tok != NULL;
+        tok = strtok_r(NULL, ",", &save)) {
+        count = 0;
+        if (sscanf(tok, "%u:%u", &size, &count) < 1 || size == 0 ||
+            size > 65000) {
+            fprintf(stderr, "invalid mbuf pool %s\n", tok);
+            return 0;
+        }
+        if (n == FF_MAX_MBUF_POOLS) {
+            fprintf(stderr, "more than %d mbuf pools\n", FF_MAX_MBUF_POOLS);
+            return 0;
+        }
+
+        pc = &cfg->dpdk.mbuf_pools[n++];
+        pc->data_size = size;
+        pc->nb_mbufs = count;
+    }
+
+    qsort(cfg->dpdk.mbuf_pools, n, sizeof(struct ff_mbuf_pool_cfg),
+        mbuf_pool_cmp);
+    cfg->dpdk.nb_mbuf_pools = n;
+
+    return 1;
+}
+
 static int
 port_cfg_handler(struct ff_config *cfg, const char *section,
     const char *name, const char *value) {
@@ -511,6 +574,14 @@ port_cfg_handler(struct ff_config *cfg, const char *section,
         }
     } else if (strcmp(name, "vip_ifname") == 0) {
         cur->vip_ifname = strdup(value);
+    } else if (strcmp(name, "power_mode") == 0) {
+        return parse_port_power_mode(cur, value);
+    } else if (strcmp(name, "mtu") == 0) {
+        cur->mtu = atoi(value);
+    } else if (strcmp(name, "rx_mbuf_size") == 0) {
+        cur->rx_mbuf_size = atoi(value);
+    } else if (strcmp(name, "rx_split") == 0) {
+        cur->rx_split = atoi(value);
     }
 
 #ifdef INET6
@@ -689,8 +760,38 @@ ini_parse_handler(void* user, const char* section, const char* name,
         pconfig->dpdk.tx_csum_offoad_skip = atoi(value);
     } else if (MATCH("dpdk", "vlan_strip")) {
         pconfig->dpdk.vlan_strip = atoi(value);
+    } else if (MATCH("dpdk", "soft_rss")) {
+        pconfig->dpdk.soft_rss = atoi(value);
+    } else if (MATCH("dpdk", "soft_lro")) {
+        pconfig->dpdk.soft_lro = atoi(value);
+    } else if (MATCH("dpdk", "soft_lro_entries")) {
+        pconfig->dpdk.soft_lro_entries = atoi(value);
+    } else if (MATCH("dpdk", "soft_gso")) {
+        pconfig->dpdk.soft_gso = atoi(value);
+    } else if (MATCH("dpdk", "tx_zerocopy")) {
+        pconfig->dpdk.tx_zerocopy = atoi(value);
     } else if (MATCH("dpdk", "idle_sleep")) {
         pconfig->dpdk.idle_sleep = atoi(value);
+    } else if (MATCH("dpdk", "loop_wait")) {
+        pconfig->dpdk.loop_wait = atoi(value);
+    } else if (MATCH("dpdk", "latency_hist")) {
+        pconfig->dpdk.latency_hist = atoi(value);
+    } else if (MATCH("dpdk", "power_empty_polls")) {
+        pconfig->dpdk.power_empty_polls = atoi(value);
+    } else if (MATCH("dpdk", "power_max_wait")) {
+        pconfig->dpdk.power_max_wait = atoi(value);
+    } else if (MATCH("dpdk", "power_intr_delay")) {
+        pconfig->dpdk.power_intr_delay = atoi(value);
+    } else if (MATCH("dpdk", "neigh_cache")) {
+        pconfig->dpdk.neigh_cache = atoi(value);
+    } else if (MATCH("dpdk", "neigh_cache_entries")) {
+        pconfig->dpdk.neigh_cache_entries = atoi(value);
+    } else if (MATCH("dpdk", "mbuf_pools")) {
+        return parse_mbuf_pools(pconfig, value);
+    } else if (MATCH("dpdk", "mbuf_low_watermark")) {
+        pconfig->dpdk.mbuf_low_watermark = atoi(value);
+    } else if (MATCH("dpdk", "mbuf_high_watermark")) {
+        pconfig->dpdk.mbuf_high_watermark = atoi(value);
     } else if (MATCH("dpdk", "pkt_tx_delay")) {
         pconfig->dpdk.pkt_tx_delay = atoi(value);
     } else if (MATCH("dpdk", "symmetric_rss")) {
@@ -714,6 +815,8 @@ ini_parse_handler(void* user, const char* section, const char* name,
             pconfig->freebsd.fd_reserve = atoi(value);
         } else if (strcmp(name, "memsz_MB") == 0) {
             pconfig->freebsd.mem_size = atoi(value);
+        } else if (strcmp(name, "hugemem_MB") == 0) {
+            pconfig->freebsd.hugemem_size = atoi(value);
         } else {
             return freebsd_conf_handler(pconfig, "boot", name, value);
         }
@@ -962,6 +1065,19 @@ ff_check_config(struct ff_config *cfg)
     if (cfg->pcap.save_path==NULL || strlen(cfg->pcap.save_path) ==0)
         cfg->pcap.save_path = strdup(".");
 
+    if (cfg->dpdk.soft_lro && cfg->dpdk.soft_lro_entries == 0)
+        cfg->dpdk.soft_lro_entries = MAX_PKT_BURST;
+
+    if (cfg->dpdk.mbuf_low_watermark > 100)
+        cfg->dpdk.mbuf_low_watermark = 100;
+    if (cfg->dpdk.mbuf_high_watermark < cfg->dpdk.mbuf_low_watermark)
+        cfg->dpdk.mbuf_high_watermark = cfg->dpdk.mbuf_low_watermark;
+
+#ifdef FF_USE_PAGE_ARRAY
+    /* the page array has its own zero-copy TX path */
+    cfg->dpdk.tx_zerocopy = 0;
+#endif
+
     #define CHECK_VALID(n) \
         do { \
             if (!pc->n) { \
@@ -1026,6 +1142,11 @@ ff_default_config(struct ff_config *cfg)
     cfg->dpdk.numa_on = 1;
     cfg->dpdk.promiscuous = 1;
     cfg->dpdk.pkt_tx_delay = BURST_TX_DRAIN_US;
+    cfg->dpdk.soft_lro_entries = MAX_PKT_BURST;
+    cfg->dpdk.neigh_cache_entries = 4096;
+    cfg->dpdk.power_empty_polls = 512;
+    cfg->dpdk.power_max_wait = 1000;
+    cfg->dpdk.power_intr_delay = 10000;
 
     cfg->freebsd.hz = 100;
     cfg->freebsd.physmem = 1048576*256;
@@ -52,6 +52,26 @@ struct ff_hw_features {
     uint8_t tx_csum_ip;
     uint8_t tx_csum_l4;
     uint8_t tx_tso;
+    /* TSO done in software by librte_gso, IPv4 only */
+    uint8_t tx_soft_tso;
+};
+
+/* mbuf pools besides the default one of RTE_MBUF_DEFAULT_DATAROOM bytes */
+#define FF_MAX_MBUF_POOLS 4
+
+struct ff_mbuf_pool_cfg {
+    /* bytes of packet data per mbuf, headroom excluded */
+    uint16_t data_size;
+    /* mbufs per socket, 0: as many as the default pool */
+    uint32_t nb_mbufs;
+};
+
+/* Ordered from the least to the most CPU saved when idle */
+enum FF_POWER_MODE {
+    FF_POWER_BUSY = 0,      /* busy poll, idle_sleep only */
+    FF_POWER_BACKOFF,       /* sleep, doubling while idle */
+    FF_POWER_MONITOR,       /* wait for the rx descriptor to be written */
+    FF_POWER_INTERRUPT,     /* rx interrupts once idle for a while */
 };
 
 struct ff_port_cfg {
@@ -85,6 +105,16 @@ struct ff_port_cfg {
     int nb_slaves;
     uint16_t lcore_list[DPDK_MAX_LCORE];
     uint16_t *slave_portid_list;
+
+    /* enum FF_POWER_MODE, how far an idle process may wait on this port */
+    int power_mode;
+
+    /* 0: the NIC's default */
+    uint16_t mtu;
+    /* data_size of the pool rx queues fill, 0: smallest that fits the mtu */
+    uint16_t rx_mbuf_size;
+    /* bytes of headers received into the smallest pool, 0: no split */
+    uint16_t rx_split;
 };
 
 struct ff_vdev_cfg {
@@ -152,9 +182,51 @@ struct ff_config {
         int vlan_strip;
         int symmetric_rss;
 
+        /* spread flows over the queues in software, for NICs without RSS */
+        int soft_rss;
+
+        /* software LRO on the rx path and its lro entries per port */
+        int soft_lro;
+        unsigned soft_lro_entries;
+
+        /* software TSO fallback when the NIC lacks it */
+        int soft_gso;
+
+        /* attach stack buffers to rte_mbuf instead of copying on TX */
+        int tx_zerocopy;
+
         /* sleep x microseconds when no pkts incomming */
         unsigned idle_sleep;
 
+        /* honor the timeout of ff_epoll_wait/ff_kevent/ff_poll */
+        int loop_wait;
+
+        /* record the main loop latency histograms */
+        int latency_hist;
+
+        /*
+         * power_mode of the ports: empty polls before waiting, max sleep
+         * or pause and idle time before rx interrupts, in microseconds.
+         */
+        unsigned power_empty_polls;
+        unsigned power_max_wait;
+        unsigned power_intr_delay;
+
+        /* neighbor cache shared by all processes and its entries */
+        int neigh_cache;
+        unsigned neigh_cache_entries;
+
+        /* extra mbuf pools, ascending data_size */
+        int nb_mbuf_pools;
+        struct ff_mbuf_pool_cfg mbuf_pools[FF_MAX_MBUF_POOLS];
+
+        /*
+         * Percent of free mbufs under which the stack is told to save
+         * them and over which it is told again it may use them, 0: off.
+         */
+        unsigned mbuf_low_watermark;
+        unsigned mbuf_high_watermark;
+
         /* TX burst queue drain nodelay dalay time */
         unsigned pkt_tx_delay;
 
@@ -193,6 +265,7 @@ struct ff_config {
         int hz;
         int fd_reserve;
         int mem_size;
+        int hugemem_size;
     } freebsd;
 
     struct {
@@ -26,7 +26,12 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <errno.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
 
 #include <rte_common.h>
 #include <rte_byteorder.h>
@@ -52,11 +57,16 @@
 #include <rte_ip.h>
 #include <rte_tcp.h>
 #include <rte_udp.h>
+#include <rte_gso.h>
 #include <rte_eth_bond.h>
 #include <rte_eth_bond_8023ad.h>
 
 #include "ff_dpdk_if.h"
 #include "ff_dpdk_pcap.h"
+#include "ff_dpdk_neigh.h"
+#include "ff_dpdk_stats.h"
+#include "ff_dpdk_power.h"
+#include "ff_dpdk_kmem.h"
 #include "ff_dpdk_kni.h"
 #include "ff_config.h"
 #include "ff_veth.h"
@@ -77,9 +87,27 @@ static int knictl_action = FF_KNICTL_ACTION_DEFAULT;
 static int numa_on;
 
 static unsigned idle_sleep;
+static int loop_wait;
 static unsigned pkt_tx_delay;
+static int tx_zerocopy;
+static int soft_rss;
 static uint64_t usr_cb_tsc;
 
+static int latency_hist;
+static struct ff_latency_hist latency_hists[FF_LATENCY_NUM];
+
+static inline void
+latency_record(enum FF_LATENCY_TYPE type, uint64_t tsc)
+{
+    struct ff_latency_hist *h = &latency_hists[type];
+
+    h->count++;
+    h->sum += tsc;
+    if (unlikely(tsc > h->max))
+        h->max = tsc;
+    h->buckets[ff_latency_bucket(tsc)]++;
+}
+
 static struct rte_timer freebsd_clock;
 
 // Mellanox Linux's driver key
@@ -118,32 +146,109 @@ struct lcore_conf lcore_conf;
 
 struct rte_mempool *pktmbuf_pool[NB_SOCKETS];
 
+/*
+ * Every mbuf pool of a socket, the default one and dpdk.mbuf_pools,
+ * ascending data_size. Sent packets take the smallest they fit in.
+ */
+struct mbuf_pool {
+    struct rte_mempool *mp;
+    uint16_t data_size;
+};
+static struct mbuf_pool mbuf_pools[NB_SOCKETS][FF_MAX_MBUF_POOLS + 1];
+static int nb_mbuf_pools;
+
+/*
+ * indirect mbufs sharing one ARP/NDP frame with every other queue, KNI
+ * still gets a copy; its size bounds what an ARP flood can hold.
+ */
+static struct rte_mempool *bcast_indirect_pool[NB_SOCKETS];
+#define BCAST_MBUF_PER_QUEUE (4 * MAX_PKT_BURST)
+
+/* indirect mbufs of software GSO segments, pointing into the TSO packet */
+static struct rte_mempool *gso_indirect_pool[NB_SOCKETS];
+
+/* TSO packets are at most IP_MAXPACKET, net.inet.tcp.minmss defaults to 216 */
+#define GSO_MAX_SEGS (UINT16_MAX / 216 + 1)
+
+/*
+ * Zero-copy TX: stack buffers living in DPDK memory are attached to the
+ * rte_mbuf as external buffers, the stack mbuf chain is held by a zc_tx_ref
+ * and freed when the NIC has sent the last segment referring to it.
+ * Shorter segments than this are cheaper to copy.
+ */
+#define ZC_TX_MIN_LEN 256
+
+struct zc_tx_ref {
+    struct rte_mbuf_ext_shared_info shinfo;
+    struct rte_mempool *pool;
+    void *m;
+};
+
+static struct rte_mempool *zc_tx_ref_pool[NB_SOCKETS];
+
 static pcblddr_func_t pcblddr_fun;
 
 static struct rte_ring **dispatch_ring[RTE_MAX_ETHPORTS];
 static dispatch_func_t packet_dispatcher;
+static dispatch_burst_func_t packet_burst_dispatcher;
 
 static uint16_t rss_reta_size[RTE_MAX_ETHPORTS];
 
 #define BOND_DRIVER_NAME    "net_bonding"
 
 static inline int send_single_packet(struct rte_mbuf *m, uint8_t port);
+static void soft_rss_dispatch(uint16_t port_id, void **data,
+    const uint16_t *lens, int *queues, uint16_t count, uint16_t queue_id,
+    uint16_t nb_queues);
 
 struct ff_msg_ring {
-    char ring_name[FF_MSG_NUM][RTE_RING_NAMESIZE];
-    /* ring[0] for lcore recv msg, other send */
-    /* ring[1] for lcore send msg, other read */
-    struct rte_ring *ring[FF_MSG_NUM];
+    char ring_name[RTE_RING_NAMESIZE];
+    /* requests from any process, replies are completed in place */
+    struct rte_ring *ring;
 } __rte_cache_aligned;
 
 static struct ff_msg_ring msg_ring[RTE_MAX_LCORE];
 static struct rte_mempool *message_pool;
 static struct ff_dpdk_if_context *veth_ctx[RTE_MAX_ETHPORTS];
 
-static struct ff_top_args ff_top_status;
-static struct ff_traffic_args ff_traffic;
+/* this process's slot of the shared stats */
+static struct ff_lcore_stats *lcore_stats;
+static struct rte_timer stats_timer;
 extern void ff_hardclock(void);
 
+/*
+ * Set from when the free mbufs of a pool fall under dpdk.mbuf_low_watermark
+ * percent, or one can't be allocated, until all of them are over
+ * dpdk.mbuf_high_watermark again. The stack reads it with ff_mbuf_pressure()
+ * and stops taking more mbufs than it needs.
+ */
+static int mbuf_pressure;
+
+int
+ff_mbuf_pressure(void)
+{
+    return mbuf_pressure;
+}
+
+static inline void
+mbuf_pressure_enter(void)
+{
+    if (mbuf_pressure || ff_global_cfg.dpdk.mbuf_low_watermark == 0) {
+        return;
+    }
+
+    mbuf_pressure = 1;
+    lcore_stats->mbuf_pressure = 1;
+    lcore_stats->mbuf_pressure_events++;
+}
+
+static inline void
+mbuf_nomem_drop(enum FF_DROP_REASON reason)
+{
+    lcore_stats->drops[reason]++;
+    mbuf_pressure_enter();
+}
+
 static void
 ff_hardclock_job(__rte_unused struct rte_timer *timer,
     __rte_unused void *arg) {
@@ -289,7 +394,8 @@ init_lcore_conf(void)
 
         /* Enable pcap dump */
         if (ff_global_cfg.pcap.enable) {
-            ff_enable_pcap(ff_global_cfg.pcap.save_path, ff_global_cfg.pcap.snap_len);
+            ff_enable_pcap(ff_global_cfg.pcap.save_path, ff_global_cfg.pcap.snap_len,
+                ff_global_cfg.pcap.save_len);
         }
 
         lcore_conf.nb_queue_list[port_id] = pconf->nb_lcores;
@@ -302,6 +408,72 @@ init_lcore_conf(void)
     return 0;
 }
 
+static struct rte_mempool *
+create_mbuf_pool(const char *name, unsigned nb_mbuf, uint16_t data_size,
+    unsigned socketid)
+{
+    if (rte_eal_process_type() == RTE_PROC_PRIMARY) {
+        return rte_pktmbuf_pool_create(name, nb_mbuf, MEMPOOL_CACHE_SIZE, 0,
+            data_size + RTE_PKTMBUF_HEADROOM, socketid);
+    }
+
+    return rte_mempool_lookup(name);
+}
+
+static void
+init_mbuf_pools(unsigned socketid, unsigned nb_mbuf)
+{
+    struct mbuf_pool *pools = mbuf_pools[socketid];
+    struct ff_mbuf_pool_cfg *pc;
+    int i, n = 0, dflt = 0;
+    char s[64];
+
+    for (i = 0; i < ff_global_cfg.dpdk.nb_mbuf_pools; i++) {
+        pc = &ff_global_cfg.dpdk.mbuf_pools[i];
+        if (pc->data_size == RTE_MBUF_DEFAULT_DATAROOM) {
+            continue;
+        }
+
+        if (!dflt && pc->data_size > RTE_MBUF_DEFAULT_DATAROOM) {
+            pools[n].mp = pktmbuf_pool[socketid];
+            pools[n++].data_size = RTE_MBUF_DEFAULT_DATAROOM;
+            dflt = 1;
+        }
+
+        snprintf(s, sizeof(s), "mbuf_pool_%d_%u", socketid, pc->data_size);
+        pools[n].mp = create_mbuf_pool(s, pc->nb_mbufs ? pc->nb_mbufs : nb_mbuf,
+            pc->data_size, socketid);
+        if (pools[n].mp == NULL) {
+            rte_exit(EXIT_FAILURE, "Cannot create %s\n", s);
+        }
+        pools[n++].data_size = pc->data_size;
+        printf("create %s\n", s);
+    }
+
+    if (!dflt) {
+        pools[n].mp = pktmbuf_pool[socketid];
+        pools[n++].data_size = RTE_MBUF_DEFAULT_DATAROOM;
+    }
+
+    nb_mbuf_pools = n;
+}
+
+/* Smallest pool of the socket len bytes fit in, else the largest one */
+static inline const struct mbuf_pool *
+mbuf_pool_fit(unsigned socketid, uint32_t len)
+{
+    const struct mbuf_pool *pools = mbuf_pools[socketid];
+    int i;
+
+    for (i = 0; i < nb_mbuf_pools - 1; i++) {
+        if (len <= pools[i].data_size) {
+            break;
+        }
+    }
+
+    return &pools[i];
+}
+
 static int
 init_mem_pool(void)
 {
@@ -342,16 +514,9 @@ init_mem_pool(void)
             continue;
         }
 
-        if (rte_eal_process_type() == RTE_PROC_PRIMARY) {
-            snprintf(s, sizeof(s), "mbuf_pool_%d", socketid);
-            pktmbuf_pool[socketid] =
-                rte_pktmbuf_pool_create(s, nb_mbuf,
-                    MEMPOOL_CACHE_SIZE, 0,
-                    RTE_MBUF_DEFAULT_BUF_SIZE, socketid);
-        } else {
-            snprintf(s, sizeof(s), "mbuf_pool_%d", socketid);
-            pktmbuf_pool[socketid] = rte_mempool_lookup(s);
-        }
+        snprintf(s, sizeof(s), "mbuf_pool_%d", socketid);
+        pktmbuf_pool[socketid] = create_mbuf_pool(s, nb_mbuf,
+            RTE_MBUF_DEFAULT_DATAROOM, socketid);
 
         if (pktmbuf_pool[socketid] == NULL) {
             rte_exit(EXIT_FAILURE, "Cannot create mbuf pool on socket %d\n", socketid);
@@ -359,6 +524,57 @@ init_mem_pool(void)
             printf("create mbuf pool on socket %d\n", socketid);
         }
 
+        init_mbuf_pools(socketid, nb_mbuf);
+
+        snprintf(s, sizeof(s), "bcast_indirect_pool_%d", socketid);
+        if (rte_eal_process_type() == RTE_PROC_PRIMARY) {
+            bcast_indirect_pool[socketid] = rte_pktmbuf_pool_create(s,
+                RTE_ALIGN_CEIL(nb_lcores * nb_ports * BCAST_MBUF_PER_QUEUE,
+                    (unsigned)1024),
+                MEMPOOL_CACHE_SIZE, 0, 0, socketid);
+        } else {
+            bcast_indirect_pool[socketid] = rte_mempool_lookup(s);
+        }
+
+        if (bcast_indirect_pool[socketid] == NULL) {
+            rte_exit(EXIT_FAILURE, "Cannot create broadcast indirect pool on socket %d\n",
+                socketid);
+        }
+
+#ifndef FF_USE_PAGE_ARRAY
+        if (ff_global_cfg.dpdk.tx_zerocopy) {
+            snprintf(s, sizeof(s), "zc_tx_ref_pool_%d", socketid);
+            if (rte_eal_process_type() == RTE_PROC_PRIMARY) {
+                zc_tx_ref_pool[socketid] = rte_mempool_create(s, nb_mbuf,
+                    sizeof(struct zc_tx_ref), MEMPOOL_CACHE_SIZE, 0,
+                    NULL, NULL, NULL, NULL, socketid, 0);
+            } else {
+                zc_tx_ref_pool[socketid] = rte_mempool_lookup(s);
+            }
+
+            if (zc_tx_ref_pool[socketid] == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot create zc tx ref pool on socket %d\n",
+                    socketid);
+            }
+        }
+
+        if (ff_global_cfg.dpdk.soft_gso) {
+            snprintf(s, sizeof(s), "gso_indirect_pool_%d", socketid);
+            if (rte_eal_process_type() == RTE_PROC_PRIMARY) {
+                gso_indirect_pool[socketid] =
+                    rte_pktmbuf_pool_create(s, nb_mbuf,
+                        MEMPOOL_CACHE_SIZE, 0, 0, socketid);
+            } else {
+                gso_indirect_pool[socketid] = rte_mempool_lookup(s);
+            }
+
+            if (gso_indirect_pool[socketid] == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot create gso indirect pool on socket %d\n",
+                    socketid);
+            }
+        }
+#endif
+
 #ifdef FF_USE_PAGE_ARRAY
         nb_mbuf = RTE_ALIGN_CEIL (
             nb_ports*nb_lcores*MAX_PKT_BURST    +
@@ -409,6 +625,13 @@ init_dispatch_ring(void)
         uint16_t portid = ff_global_cfg.dpdk.portid_list[j];
         struct ff_port_cfg *pconf = &ff_global_cfg.dpdk.port_cfgs[portid];
         int nb_queues = pconf->nb_lcores;
+
+        /* the dispatch counters of ff_traffic_args are per queue */
+        if (nb_queues > FF_MAX_DISPATCH_QUEUES) {
+            rte_exit(EXIT_FAILURE, "port%d has %d queues, at most %d "
+                "supported\n", portid, nb_queues, FF_MAX_DISPATCH_QUEUES);
+        }
+
         if (dispatch_ring[portid] == NULL) {
             snprintf(name_buf, RTE_RING_NAMESIZE, "ring_ptr_p%d", portid);
 
@@ -445,6 +668,7 @@ ff_msg_init(struct rte_mempool *mp,
 {
     struct ff_msg *msg = (struct ff_msg *)obj;
     msg->msg_type = FF_UNKNOWN;
+    msg->state = FF_MSG_DONE;
     msg->buf_addr = (char *)msg + sizeof(struct ff_msg);
     msg->buf_len = mp->elt_size - sizeof(struct ff_msg);
     msg->original_buf = NULL;
@@ -454,7 +678,7 @@ ff_msg_init(struct rte_mempool *mp,
 static int
 init_msg_ring(void)
 {
-    uint16_t i, j;
+    uint16_t i;
     uint16_t nb_procs = ff_global_cfg.dpdk.nb_procs;
     unsigned socketid = lcore_conf.socket_id;
 
@@ -473,22 +697,14 @@ init_msg_ring(void)
         rte_panic("Create msg mempool failed\n");
     }
 
+    /* several tools may send to one process at the same time */
     for(i = 0; i < nb_procs; ++i) {
-        snprintf(msg_ring[i].ring_name[0], RTE_RING_NAMESIZE,
+        snprintf(msg_ring[i].ring_name, RTE_RING_NAMESIZE,
             "%s%u", FF_MSG_RING_IN, i);
-        msg_ring[i].ring[0] = create_ring(msg_ring[i].ring_name[0],
-            MSG_RING_SIZE, socketid, RING_F_SP_ENQ | RING_F_SC_DEQ);
-        if (msg_ring[i].ring[0] == NULL)
-            rte_panic("create ring::%s failed!\n", msg_ring[i].ring_name[0]);
-
-        for (j = FF_SYSCTL; j < FF_MSG_NUM; j++) {
-            snprintf(msg_ring[i].ring_name[j], RTE_RING_NAMESIZE,
-                "%s%u_%u", FF_MSG_RING_OUT, i, j);
-            msg_ring[i].ring[j] = create_ring(msg_ring[i].ring_name[j],
-                MSG_RING_SIZE, socketid, RING_F_SP_ENQ | RING_F_SC_DEQ);
-            if (msg_ring[i].ring[j] == NULL)
-                rte_panic("create ring::%s failed!\n", msg_ring[i].ring_name[j]);
-        }
+        msg_ring[i].ring = create_ring(msg_ring[i].ring_name,
+            MSG_RING_SIZE, socketid, RING_F_SC_DEQ);
+        if (msg_ring[i].ring == NULL)
+            rte_panic("create ring::%s failed!\n", msg_ring[i].ring_name);
     }
 
     return 0;
@@ -570,7 +786,8 @@ init_port_start(void)
 {
     int nb_ports = ff_global_cfg.dpdk.nb_ports;
     unsigned socketid = 0;
-    struct rte_mempool *mbuf_pool;
+    const struct mbuf_pool *rx_pool, *pools;
+    union rte_eth_rxseg rx_seg[2];
     uint16_t i, j;
 
     for (i = 0; i < nb_ports; i++) {
@@ -649,7 +866,13 @@ init_port_start(void)
                         port_conf.rx_adv_conf.rss_conf.rss_hf);
             }
 
-            if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) {
+            /*
+             * Fast free requires direct mbufs from one pool,
+             * zero-copy and gso segments are neither.
+             */
+            if ((dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) &&
+                !ff_global_cfg.dpdk.tx_zerocopy && !ff_global_cfg.dpdk.soft_gso &&
+                nb_mbuf_pools == 1) {
                 port_conf.txmode.offloads |=
                     DEV_TX_OFFLOAD_MBUF_FAST_FREE;
             }
@@ -712,6 +935,13 @@ init_port_start(void)
                 printf("TSO is disabled\n");
             }
 
+#ifndef FF_USE_PAGE_ARRAY
+            if (!pconf->hw_features.tx_tso && ff_global_cfg.dpdk.soft_gso) {
+                printf("Software GSO is enabled\n");
+                pconf->hw_features.tx_soft_tso = 1;
+            }
+#endif
+
             if (dev_info.reta_size) {
                 /* reta size must be power of 2 */
                 assert((dev_info.reta_size & (dev_info.reta_size - 1)) == 0);
@@ -725,6 +955,57 @@ init_port_start(void)
                 continue;
             }
 
+            if (pconf->power_mode == FF_POWER_INTERRUPT) {
+                port_conf.intr_conf.rxq = 1;
+            }
+
+            if (pconf->mtu) {
+                if (pconf->mtu < dev_info.min_mtu || pconf->mtu > dev_info.max_mtu) {
+                    rte_exit(EXIT_FAILURE, "port %u mtu %u out of range %u-%u\n",
+                        port_id, pconf->mtu, dev_info.min_mtu, dev_info.max_mtu);
+                }
+                port_conf.rxmode.mtu = pconf->mtu;
+            }
+
+            /*
+             * Receive into the pool asked for or the smallest a frame fits
+             * in, in several mbufs if it doesn't fit.
+             */
+            uint32_t max_frame = (pconf->mtu ? pconf->mtu : RTE_ETHER_MTU) +
+                RTE_ETHER_HDR_LEN + RTE_ETHER_CRC_LEN + 2 * RTE_VLAN_HLEN;
+            pools = mbuf_pools[lcore_conf.socket_id];
+            if (pconf->rx_mbuf_size) {
+                rx_pool = mbuf_pool_fit(lcore_conf.socket_id, pconf->rx_mbuf_size);
+                if (rx_pool->data_size != pconf->rx_mbuf_size) {
+                    rte_exit(EXIT_FAILURE, "port %u rx_mbuf_size %u is not a pool\n",
+                        port_id, pconf->rx_mbuf_size);
+                }
+            } else {
+                rx_pool = mbuf_pool_fit(lcore_conf.socket_id, max_frame);
+            }
+
+            if (pconf->rx_split) {
+                if (!(dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_BUFFER_SPLIT) ||
+                    rx_pool == &pools[0] || pconf->rx_split > pools[0].data_size) {
+                    printf("port %u can't split rx buffers, rx_split ignored\n",
+                        port_id);
+                    pconf->rx_split = 0;
+                } else {
+                    port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_BUFFER_SPLIT;
+                }
+            }
+
+            if (max_frame > rx_pool->data_size || pconf->rx_split) {
+                if (!(dev_info.rx_offload_capa & DEV_RX_OFFLOAD_SCATTER)) {
+                    rte_exit(EXIT_FAILURE, "port %u can't receive frames of %u "
+                        "bytes in mbufs of %u\n", port_id, max_frame,
+                        rx_pool->data_size);
+                }
+                port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_SCATTER;
+            }
+            printf("port %u receives into mbufs of %u bytes%s\n", port_id,
+                rx_pool->data_size, pconf->rx_split ? ", headers split" : "");
+
             ret = rte_eth_dev_configure(port_id, nb_queues, nb_queues, &port_conf);
             if (ret != 0) {
                 return ret;
@@ -743,8 +1024,6 @@ init_port_start(void)
                     uint16_t lcore_id = lcore_conf.port_cfgs[u_port_id].lcore_list[q];
                     socketid = rte_lcore_to_socket_id(lcore_id);
                 }
-                mbuf_pool = pktmbuf_pool[socketid];
-
                 txq_conf = dev_info.default_txconf;
                 txq_conf.offloads = port_conf.txmode.offloads;
                 ret = rte_eth_tx_queue_setup(port_id, q, nb_txd,
@@ -755,8 +1034,20 @@ init_port_start(void)
 
                 rxq_conf = dev_info.default_rxconf;
                 rxq_conf.offloads = port_conf.rxmode.offloads;
+                /* same sizes on every socket */
+                struct rte_mempool *mp =
+                    mbuf_pool_fit(socketid, rx_pool->data_size)->mp;
+                if (pconf->rx_split) {
+                    memset(rx_seg, 0, sizeof(rx_seg));
+                    rx_seg[0].split.mp = mbuf_pools[socketid][0].mp;
+                    rx_seg[0].split.length = pconf->rx_split;
+                    rx_seg[1].split.mp = mp;
+                    rxq_conf.rx_seg = rx_seg;
+                    rxq_conf.rx_nseg = RTE_DIM(rx_seg);
+                    mp = NULL;
+                }
                 ret = rte_eth_rx_queue_setup(port_id, q, nb_rxd,
-                    socketid, &rxq_conf, mbuf_pool);
+                    socketid, &rxq_conf, mp);
                 if (ret < 0) {
                     return ret;
                 }
@@ -825,6 +1116,63 @@ init_port_start(void)
     return 0;
 }
 
+/* Gauges are too costly to keep current on every packet, sample them */
+static void
+ff_stats_sample(__rte_unused struct rte_timer *tim,
+    __rte_unused void *arg)
+{
+    struct lcore_conf *qconf = &lcore_conf;
+    struct rte_mempool *mp = pktmbuf_pool[qconf->socket_id];
+    unsigned low = ff_global_cfg.dpdk.mbuf_low_watermark;
+    unsigned high = ff_global_cfg.dpdk.mbuf_high_watermark;
+    int under_low = 0, under_high = 0;
+    uint64_t count = 0;
+    uint16_t i;
+
+    for (i = 0; i < qconf->nb_rx_queue; i++) {
+        count += rte_ring_count(dispatch_ring[qconf->rx_queue_list[i].port_id]
+            [qconf->rx_queue_list[i].queue_id]);
+    }
+
+    lcore_stats->dispatch_ring_count = count;
+    lcore_stats->mbuf_avail = rte_mempool_avail_count(mp);
+    lcore_stats->mbuf_in_use = rte_mempool_in_use_count(mp);
+
+    lcore_stats->nb_pools = nb_mbuf_pools;
+    for (i = 0; i < nb_mbuf_pools; i++) {
+        const struct mbuf_pool *pool = &mbuf_pools[qconf->socket_id][i];
+        struct rte_mempool_cache *cache;
+        uint64_t common, cached, avail;
+
+        /* other lcores' caches are out of reach of this one */
+        cache = rte_mempool_default_cache(pool->mp, rte_lcore_id());
+        common = rte_mempool_ops_get_count(pool->mp);
+        cached = cache ? cache->len : 0;
+        avail = (common + cached) * 100;
+
+        lcore_stats->pools[i].data_size = pool->data_size;
+        lcore_stats->pools[i].avail = rte_mempool_avail_count(pool->mp);
+        lcore_stats->pools[i].in_use = rte_mempool_in_use_count(pool->mp);
+        lcore_stats->pools[i].common = common;
+        lcore_stats->pools[i].cache = cached;
+
+        if (avail < (uint64_t)pool->mp->size * low) {
+            under_low = 1;
+        }
+        if (avail < (uint64_t)pool->mp->size * high) {
+            under_high = 1;
+        }
+    }
+
+    if (under_low) {
+        mbuf_pressure_enter();
+    } else if (mbuf_pressure && !under_high) {
+        mbuf_pressure = 0;
+        lcore_stats->mbuf_pressure = 0;
+    }
+    lcore_stats->sample_tsc = rte_rdtsc();
+}
+
 static int
 init_clock(void)
 {
@@ -837,6 +1185,10 @@ init_clock(void)
     rte_timer_reset(&freebsd_clock, tsc, PERIODICAL,
         rte_lcore_id(), &ff_hardclock_job, NULL);
 
+    rte_timer_init(&stats_timer);
+    rte_timer_reset(&stats_timer, hz / 1000 * FF_STATS_SAMPLE_MS, PERIODICAL,
+        rte_lcore_id(), &ff_stats_sample, NULL);
+
     ff_update_current_ts();
 
     return 0;
@@ -1177,6 +1529,10 @@ ff_dpdk_init(int argc, char **argv)
     numa_on = ff_global_cfg.dpdk.numa_on;
 
     idle_sleep = ff_global_cfg.dpdk.idle_sleep;
+    loop_wait = ff_global_cfg.dpdk.loop_wait;
+    latency_hist = ff_global_cfg.dpdk.latency_hist;
+    tx_zerocopy = ff_global_cfg.dpdk.tx_zerocopy;
+    soft_rss = ff_global_cfg.dpdk.soft_rss;
     pkt_tx_delay = ff_global_cfg.dpdk.pkt_tx_delay > BURST_TX_DRAIN_US ? \
         BURST_TX_DRAIN_US : ff_global_cfg.dpdk.pkt_tx_delay;
 
@@ -1184,10 +1540,26 @@ ff_dpdk_init(int argc, char **argv)
 
     init_mem_pool();
 
+    if (ff_kmem_init(lcore_conf.socket_id,
+        (uint64_t)ff_global_cfg.freebsd.hugemem_size << 20) < 0) {
+        rte_exit(EXIT_FAILURE, "init kmem failed\n");
+    }
+
     init_dispatch_ring();
 
     init_msg_ring();
 
+    lcore_stats = ff_stats_init(lcore_conf.proc_id,
+        ff_global_cfg.dpdk.nb_procs);
+    if (lcore_stats == NULL) {
+        rte_exit(EXIT_FAILURE, "init stats failed\n");
+    }
+
+    if (ff_global_cfg.dpdk.neigh_cache &&
+        ff_neigh_cache_init(ff_global_cfg.dpdk.neigh_cache_entries) < 0) {
+        rte_exit(EXIT_FAILURE, "init neigh cache failed\n");
+    }
+
 #ifdef FF_KNI
     enable_kni = ff_global_cfg.kni.enable;
     if (enable_kni) {
@@ -1237,24 +1609,56 @@ ff_dpdk_init(int argc, char **argv)
     return 0;
 }
 
-static void
-ff_veth_input(const struct ff_dpdk_if_context *ctx, struct rte_mbuf *pkt)
+/* Copy of a packet whose data is shared, the stack gets its own buffer */
+static void *
+ff_veth_rx_copy(struct rte_mbuf *pkt, uint8_t rx_csum)
+{
+    struct rte_mbuf *pn;
+    void *hdr;
+
+    hdr = ff_mbuf_devget(rte_pktmbuf_mtod(pkt, void *),
+        rte_pktmbuf_data_len(pkt), rx_csum);
+    for (pn = pkt->next; hdr != NULL && pn != NULL; pn = pn->next) {
+        if (!ff_mbuf_append(hdr, rte_pktmbuf_mtod(pn, void *),
+                rte_pktmbuf_data_len(pn))) {
+            ff_mbuf_free(hdr);
+            hdr = NULL;
+        }
+    }
+
+    if (hdr != NULL && (pkt->ol_flags & RTE_MBUF_F_RX_VLAN_STRIPPED)) {
+        ff_mbuf_set_vlan_info(hdr, pkt->vlan_tci);
+    }
+
+    rte_pktmbuf_free(pkt);
+    return hdr;
+}
+
+static inline void *
+ff_veth_rx_mbuf(const struct ff_dpdk_if_context *ctx, struct rte_mbuf *pkt)
 {
     uint8_t rx_csum = ctx->hw_features.rx_csum;
     if (rx_csum) {
         if (pkt->ol_flags & (RTE_MBUF_F_RX_IP_CKSUM_BAD | RTE_MBUF_F_RX_L4_CKSUM_BAD)) {
+            lcore_stats->drops[FF_DROP_RX_CSUM]++;
             rte_pktmbuf_free(pkt);
-            return;
+            return NULL;
         }
     }
 
+    /* ARP/NDP broadcast to all the queues, see process_packets() */
+    if (unlikely(RTE_MBUF_CLONED(pkt) || rte_mbuf_refcnt_read(pkt) > 1)) {
+        return ff_veth_rx_copy(pkt, rx_csum);
+    }
+
     void *data = rte_pktmbuf_mtod(pkt, void*);
     uint16_t len = rte_pktmbuf_data_len(pkt);
 
     void *hdr = ff_mbuf_gethdr(pkt, pkt->pkt_len, data, len, rx_csum);
     if (hdr == NULL) {
+        lcore_stats->drops[FF_DROP_RX_NOMEM]++;
         rte_pktmbuf_free(pkt);
-        return;
+        return NULL;
     }
 
     if (pkt->ol_flags & RTE_MBUF_F_RX_VLAN_STRIPPED) {
@@ -1269,15 +1673,35 @@ ff_veth_input(const struct ff_dpdk_if_context *ctx, struct rte_mbuf *pkt)
 
         void *mb = ff_mbuf_get(prev, pn, data, len);
         if (mb == NULL) {
+            lcore_stats->drops[FF_DROP_RX_NOMEM]++;
             ff_mbuf_free(hdr);
             rte_pktmbuf_free(pkt);
-            return;
+            return NULL;
         }
         pn = pn->next;
         prev = mb;
     }
 
-    ff_veth_process_packet(ctx->ifp, hdr);
+    return hdr;
+}
+
+static inline void
+ff_veth_input(const struct ff_dpdk_if_context *ctx, struct rte_mbuf **pkts,
+    uint16_t count)
+{
+    void *hdrs[MAX_PKT_BURST];
+    uint16_t i, nb_hdrs = 0;
+
+    for (i = 0; i < count; i++) {
+        void *hdr = ff_veth_rx_mbuf(ctx, pkts[i]);
+        if (hdr != NULL) {
+            hdrs[nb_hdrs++] = hdr;
+        }
+    }
+
+    if (nb_hdrs > 0) {
+        ff_veth_process_packets(ctx->ifp, hdrs, nb_hdrs);
+    }
 }
 
 static enum FilterReturn
@@ -1404,35 +1828,142 @@ ff_add_vlan_tag(struct rte_mbuf * rtem)
     }
 }
 
+/* Stage a packet for another queue's dispatch ring */
+static inline void
+stage_dispatch_packet(uint16_t queue_id, struct rte_mbuf *m)
+{
+    struct mbuf_table *mt = &lcore_conf.dispatch_mbufs[queue_id];
+    mt->m_table[mt->len++] = m;
+}
+
+/* Enqueue all staged packets, one bulk enqueue per dispatch ring */
+static inline void
+flush_dispatch_packets(uint16_t port_id, uint16_t nb_queues)
+{
+    struct lcore_conf *qconf = &lcore_conf;
+    uint16_t q;
+
+    for (q = 0; q < nb_queues; q++) {
+        struct mbuf_table *mt = &qconf->dispatch_mbufs[q];
+        uint16_t n = mt->len;
+        if (n == 0)
+            continue;
+
+        unsigned nb_enq = rte_ring_enqueue_burst(dispatch_ring[port_id][q],
+            (void **)mt->m_table, n, NULL);
+        lcore_stats->traffic.dispatch_packets[q] += nb_enq;
+        if (unlikely(nb_enq < n)) {
+            lcore_stats->traffic.dispatch_drops[q] += n - nb_enq;
+            lcore_stats->drops[FF_DROP_RING_FULL] += n - nb_enq;
+            rte_pktmbuf_free_bulk(&mt->m_table[nb_enq], n - nb_enq);
+        }
+
+        mt->len = 0;
+    }
+}
+
+/*
+ * Let the user's burst dispatcher, or the software RSS one when the
+ * user registered none, choose the queues of a whole burst.
+ */
+static inline void
+dispatch_burst(uint16_t port_id, struct rte_mbuf **bufs, uint16_t count,
+    uint16_t queue_id, uint16_t nb_queues, int *queues, uint16_t *lens)
+{
+    void *data[MAX_PKT_BURST];
+    uint16_t i;
+
+    for (i = 0; i < count; i++) {
+        data[i] = rte_pktmbuf_mtod(bufs[i], void *);
+        lens[i] = rte_pktmbuf_data_len(bufs[i]);
+    }
+
+    if (packet_burst_dispatcher == NULL) {
+        soft_rss_dispatch(port_id, data, lens, queues, count, queue_id,
+            nb_queues);
+        return;
+    }
+
+    uint64_t cur_tsc = rte_rdtsc();
+    (*packet_burst_dispatcher)(data, lens, queues, count, queue_id, nb_queues);
+    cur_tsc = rte_rdtsc() - cur_tsc;
+    usr_cb_tsc += cur_tsc;
+    if (unlikely(latency_hist)) {
+        latency_record(FF_LATENCY_DISPATCH, cur_tsc);
+    }
+}
+
+/*
+ * Classify a whole burst first, every packet goes to exactly one of
+ * the stack, KNI or another queue's dispatch ring (ARP/NDP are also
+ * shared with all the other queues through indirect mbufs and copied
+ * to KNI),
+ * then each group is handed over with a single call.
+ */
 static inline void
 process_packets(uint16_t port_id, uint16_t queue_id, struct rte_mbuf **bufs,
     uint16_t count, const struct ff_dpdk_if_context *ctx, int pkts_from_ring)
 {
     struct lcore_conf *qconf = &lcore_conf;
     uint16_t nb_queues = qconf->nb_queue_list[port_id];
+    struct rte_mbuf *stack_pkts[MAX_PKT_BURST];
+    uint16_t nb_stack = 0;
+#ifdef FF_KNI
+    struct rte_mbuf *kni_pkts[MAX_PKT_BURST];
+    uint16_t nb_kni = 0;
+#endif
+    uint64_t rx_packets = 0, rx_bytes = 0;
+    int staged = 0;
+    int burst_dispatch = !pkts_from_ring &&
+        (packet_burst_dispatcher != NULL ||
+        (soft_rss && packet_dispatcher == NULL && nb_queues > 1));
+    int dispatch_queues[MAX_PKT_BURST];
+    uint16_t dispatch_lens[MAX_PKT_BURST];
+
+    if (unlikely(ff_global_cfg.pcap.enable) && !pkts_from_ring) {
+        ff_dump_packets(port_id, queue_id, bufs, count, 0);
+    }
+
+    if (burst_dispatch) {
+        dispatch_burst(port_id, bufs, count, queue_id, nb_queues,
+            dispatch_queues, dispatch_lens);
+    }
 
     uint16_t i;
+    for (i = 0; i < PREFETCH_OFFSET && i < count; i++) {
+        rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void *));
+    }
+
     for (i = 0; i < count; i++) {
         struct rte_mbuf *rtem = bufs[i];
 
-        if (unlikely( ff_global_cfg.pcap.enable)) {
-            if (!pkts_from_ring) {
-                ff_dump_packets( ff_global_cfg.pcap.save_path, rtem, ff_global_cfg.pcap.snap_len, ff_global_cfg.pcap.save_len);
-            }
+        if (i + PREFETCH_OFFSET < count) {
+            rte_prefetch0(rte_pktmbuf_mtod(bufs[i + PREFETCH_OFFSET], void *));
         }
 
         void *data = rte_pktmbuf_mtod(rtem, void*);
         uint16_t len = rte_pktmbuf_data_len(rtem);
 
         if (!pkts_from_ring) {
-            ff_traffic.rx_packets += rtem->nb_segs;
-            ff_traffic.rx_bytes += rte_pktmbuf_pkt_len(rtem);
+            rx_packets += rtem->nb_segs;
+            rx_bytes += rte_pktmbuf_pkt_len(rtem);
         }
 
-        if (!pkts_from_ring && packet_dispatcher) {
-            uint64_t cur_tsc = rte_rdtsc();
-            int ret = (*packet_dispatcher)(data, &len, queue_id, nb_queues);
-            usr_cb_tsc += rte_rdtsc() - cur_tsc;
+        if (burst_dispatch || (!pkts_from_ring && packet_dispatcher)) {
+            int ret;
+            if (burst_dispatch) {
+                ret = dispatch_queues[i];
+                len = dispatch_lens[i];
+            } else {
+                uint64_t cur_tsc = rte_rdtsc();
+                ret = (*packet_dispatcher)(data, &len, queue_id, nb_queues);
+                cur_tsc = rte_rdtsc() - cur_tsc;
+                usr_cb_tsc += cur_tsc;
+                if (unlikely(latency_hist)) {
+                    latency_record(FF_LATENCY_DISPATCH, cur_tsc);
+                }
+            }
+
             if (ret == FF_DISPATCH_RESPONSE) {
                 rte_pktmbuf_pkt_len(rtem) = rte_pktmbuf_data_len(rtem) = len;
                 /*
@@ -1443,16 +1974,15 @@ process_packets(uint16_t port_id, uint16_t queue_id, struct rte_mbuf **bufs,
                 continue;
             }
 
-            if (ret == FF_DISPATCH_ERROR || ret >= nb_queues) {
+            if (ret < 0 || ret >= nb_queues) {
+                lcore_stats->drops[FF_DROP_DISPATCH]++;
                 rte_pktmbuf_free(rtem);
                 continue;
             }
 
             if (ret != queue_id) {
-                ret = rte_ring_enqueue(dispatch_ring[port_id][ret], rtem);
-                if (ret < 0)
-                    rte_pktmbuf_free(rtem);
-
+                stage_dispatch_packet(ret, rtem);
+                staged = 1;
                 continue;
             }
         }
@@ -1465,6 +1995,11 @@ process_packets(uint16_t port_id, uint16_t queue_id, struct rte_mbuf **bufs,
 #endif
             struct rte_mempool *mbuf_pool;
             struct rte_mbuf *mbuf_clone;
+            /*
+             * The frame isn't copied, each queue gets an indirect mbuf
+             * holding a reference, a stack copies the few bytes it needs
+             * when taking it in (ff_veth_rx_copy) as it may rewrite it.
+             */
             if (!pkts_from_ring) {
                 uint16_t j;
                 for(j = 0; j < nb_queues; ++j) {
@@ -1476,52 +2011,80 @@ process_packets(uint16_t port_id, uint16_t queue_id, struct rte_mbuf **bufs,
                         uint16_t lcore_id = qconf->port_cfgs[port_id].lcore_list[j];
                         socket_id = rte_lcore_to_socket_id(lcore_id);
                     }
-                    mbuf_pool = pktmbuf_pool[socket_id];
-                    mbuf_clone = pktmbuf_deep_clone(rtem, mbuf_pool);
+                    mbuf_pool = bcast_indirect_pool[socket_id];
+                    mbuf_clone = rte_pktmbuf_clone(rtem, mbuf_pool);
                     if(mbuf_clone) {
-                        int ret = rte_ring_enqueue(dispatch_ring[port_id][j],
-                            mbuf_clone);
-                        if (ret < 0)
-                            rte_pktmbuf_free(mbuf_clone);
+                        stage_dispatch_packet(j, mbuf_clone);
+                        staged = 1;
+                    } else {
+                        lcore_stats->drops[FF_DROP_CLONE_NOMEM]++;
                     }
                 }
             }
 
 #ifdef FF_KNI
             if (enable_kni && rte_eal_process_type() == RTE_PROC_PRIMARY) {
+                /*
+                 * KNI hands the kernel the mbuf's own buffer, an indirect
+                 * one has none, so it always gets a copy.
+                 */
                 mbuf_pool = pktmbuf_pool[qconf->socket_id];
                 mbuf_clone = pktmbuf_deep_clone(rtem, mbuf_pool);
-                if(mbuf_clone) {
+                if (mbuf_clone && (rtem->ol_flags & RTE_MBUF_F_RX_VLAN_STRIPPED)) {
                     ff_add_vlan_tag(mbuf_clone);
-                    ff_kni_enqueue(port_id, mbuf_clone);
+                }
+
+                if(mbuf_clone) {
+                    kni_pkts[nb_kni++] = mbuf_clone;
+                } else {
+                    lcore_stats->drops[FF_DROP_CLONE_NOMEM]++;
                 }
             }
 #endif
-            ff_veth_input(ctx, rtem);
+            stack_pkts[nb_stack++] = rtem;
 #ifdef FF_KNI
         } else if (enable_kni) {
             if (knictl_action == FF_KNICTL_ACTION_ALL_TO_KNI){
                 ff_add_vlan_tag(rtem);
-                ff_kni_enqueue(port_id, rtem);
+                kni_pkts[nb_kni++] = rtem;
             } else if (knictl_action == FF_KNICTL_ACTION_ALL_TO_FF){
-                ff_veth_input(ctx, rtem);
+                stack_pkts[nb_stack++] = rtem;
             } else if (knictl_action == FF_KNICTL_ACTION_DEFAULT){
                 if (enable_kni &&
                         ((filter == FILTER_KNI && kni_accept) ||
                         (filter == FILTER_UNKNOWN && !kni_accept)) ) {
                     ff_add_vlan_tag(rtem);
-                    ff_kni_enqueue(port_id, rtem);
+                    kni_pkts[nb_kni++] = rtem;
                 } else {
-                    ff_veth_input(ctx, rtem);
+                    stack_pkts[nb_stack++] = rtem;
                 }
             } else {
-                ff_veth_input(ctx, rtem);
+                stack_pkts[nb_stack++] = rtem;
             }
 #endif
         } else {
-            ff_veth_input(ctx, rtem);
+            stack_pkts[nb_stack++] = rtem;
         }
     }
+
+    if (!pkts_from_ring) {
+        lcore_stats->traffic.rx_packets += rx_packets;
+        lcore_stats->traffic.rx_bytes += rx_bytes;
+    }
+
+    if (staged) {
+        flush_dispatch_packets(port_id, nb_queues);
+    }
+
+#ifdef FF_KNI
+    if (nb_kni > 0) {
+        ff_kni_enqueue_burst(port_id, kni_pkts, nb_kni);
+    }
+#endif
+
+    if (nb_stack > 0) {
+        ff_veth_input(ctx, stack_pkts, nb_stack);
+    }
 }
 
 static inline int
@@ -1597,7 +2160,7 @@ handle_route_msg(struct ff_msg *msg)
 static inline void
 handle_top_msg(struct ff_msg *msg)
 {
-    msg->top = ff_top_status;
+    msg->top = lcore_stats->top;
     msg->result = 0;
 }
 
@@ -1657,29 +2220,97 @@ done:
 static inline void
 handle_traffic_msg(struct ff_msg *msg)
 {
-    msg->traffic = ff_traffic;
+    msg->traffic = lcore_stats->traffic;
     msg->result = 0;
 }
 
-#ifdef FF_KNI
 static inline void
-handle_knictl_msg(struct ff_msg *msg)
+handle_latency_msg(struct ff_msg *msg)
 {
-    if (msg->knictl.kni_cmd == FF_KNICTL_CMD_SET){
-        switch (msg->knictl.kni_action){
-            case FF_KNICTL_ACTION_ALL_TO_FF: knictl_action = FF_KNICTL_ACTION_ALL_TO_FF; msg->result = 0; printf("new kni action: alltoff\n"); break;
-            case FF_KNICTL_ACTION_ALL_TO_KNI: knictl_action = FF_KNICTL_ACTION_ALL_TO_KNI; msg->result = 0; printf("new kni action: alltokni\n"); break;
-            case FF_KNICTL_ACTION_DEFAULT: knictl_action = FF_KNICTL_ACTION_DEFAULT; msg->result = 0; printf("new kni action: default\n"); break;
-            default: msg->result = -1;
-        }
-    }
-    else if (msg->knictl.kni_cmd == FF_KNICTL_CMD_GET){
-        msg->knictl.kni_action = knictl_action;
-    } else {
-        msg->result = -2;
-    }
-}
-#endif
+    struct ff_latency_args *args = &msg->latency;
+    int type = args->type;
+
+    args->enabled = latency_hist;
+    args->tsc_hz = rte_get_tsc_hz();
+
+    if (type < -1 || type >= FF_LATENCY_NUM) {
+        msg->result = EINVAL;
+        return;
+    }
+
+    switch (args->cmd) {
+        case FF_LATENCY_CMD_GET:
+            if (type < 0) {
+                msg->result = EINVAL;
+                return;
+            }
+            if (msg->buf_len < sizeof(struct ff_latency_hist)) {
+                msg->result = ENOMEM;
+                return;
+            }
+            args->hist = (struct ff_latency_hist *)msg->buf_addr;
+            rte_memcpy(args->hist, &latency_hists[type],
+                sizeof(struct ff_latency_hist));
+            if (args->reset) {
+                memset(&latency_hists[type], 0, sizeof(struct ff_latency_hist));
+            }
+            break;
+        case FF_LATENCY_CMD_RESET:
+            if (type < 0) {
+                memset(latency_hists, 0, sizeof(latency_hists));
+            } else {
+                memset(&latency_hists[type], 0, sizeof(struct ff_latency_hist));
+            }
+            break;
+        default:
+            msg->result = EINVAL;
+            return;
+    }
+
+    msg->result = 0;
+}
+
+#ifdef FF_KNI
+static inline void
+handle_knictl_msg(struct ff_msg *msg)
+{
+    if (msg->knictl.kni_cmd == FF_KNICTL_CMD_SET){
+        switch (msg->knictl.kni_action){
+            case FF_KNICTL_ACTION_ALL_TO_FF: knictl_action = FF_KNICTL_ACTION_ALL_TO_FF; msg->result = 0; printf("new kni action: alltoff\n"); break;
+            case FF_KNICTL_ACTION_ALL_TO_KNI: knictl_action = FF_KNICTL_ACTION_ALL_TO_KNI; msg->result = 0; printf("new kni action: alltokni\n"); break;
+            case FF_KNICTL_ACTION_DEFAULT: knictl_action = FF_KNICTL_ACTION_DEFAULT; msg->result = 0; printf("new kni action: default\n"); break;
+            default: msg->result = -1;
+        }
+    }
+    else if (msg->knictl.kni_cmd == FF_KNICTL_CMD_GET){
+        msg->knictl.kni_action = knictl_action;
+    } else {
+        msg->result = -2;
+    }
+}
+#endif
+
+static inline void
+handle_pcap_msg(struct ff_msg *msg)
+{
+    switch (msg->pcap.cmd) {
+        case FF_PCAP_CMD_START:
+            msg->result = ff_pcap_start(&msg->pcap);
+            break;
+        case FF_PCAP_CMD_STOP:
+            ff_pcap_stop();
+            msg->result = 0;
+            break;
+        case FF_PCAP_CMD_STATUS:
+            msg->result = 0;
+            break;
+        default:
+            msg->result = EINVAL;
+            return;
+    }
+
+    ff_pcap_status(&msg->pcap);
+}
 
 static inline void
 handle_default_msg(struct ff_msg *msg)
@@ -1687,8 +2318,35 @@ handle_default_msg(struct ff_msg *msg)
     msg->result = ENOTSUP;
 }
 
+/*
+ * Replies are completed in place: the requester polls or sleeps on
+ * msg->state, so it is only woken through the futex when it is actually
+ * asleep and the loop pays nothing for requesters that are still spinning.
+ */
 static inline void
-handle_msg(struct ff_msg *msg, uint16_t proc_id)
+complete_msg(struct ff_msg *msg)
+{
+    uint32_t *state = ff_msg_state(msg);
+    uint32_t old;
+
+    old = __atomic_exchange_n(state, FF_MSG_DONE, __ATOMIC_ACQ_REL);
+    if (old == FF_MSG_WAITING) {
+        syscall(SYS_futex, state, FUTEX_WAKE, 1, NULL, NULL, 0);
+    } else if (old == FF_MSG_ABANDONED) {
+        /* requester timed out and left the message to us */
+        if (msg->original_buf) {
+            rte_free(msg->buf_addr);
+            msg->buf_addr = msg->original_buf;
+            msg->buf_len = msg->original_buf_len;
+            msg->original_buf = NULL;
+        }
+
+        rte_mempool_put(message_pool, msg);
+    }
+}
+
+static inline void
+handle_msg(struct ff_msg *msg)
 {
     switch (msg->msg_type) {
         case FF_SYSCTL:
@@ -1719,6 +2377,12 @@ handle_msg(struct ff_msg *msg, uint16_t proc_id)
         case FF_TRAFFIC:
             handle_traffic_msg(msg);
             break;
+        case FF_PCAP:
+            handle_pcap_msg(msg);
+            break;
+        case FF_LATENCY:
+            handle_latency_msg(msg);
+            break;
 #ifdef FF_KNI
         case FF_KNICTL:
             handle_knictl_msg(msg);
@@ -1728,35 +2392,38 @@ handle_msg(struct ff_msg *msg, uint16_t proc_id)
             handle_default_msg(msg);
             break;
     }
-    if (rte_ring_enqueue(msg_ring[proc_id].ring[msg->msg_type], msg) < 0) {
-        if (msg->original_buf) {
-            rte_free(msg->buf_addr);
-            msg->buf_addr = msg->original_buf;
-            msg->buf_len = msg->original_buf_len;
-            msg->original_buf = NULL;
-        }
 
-        rte_mempool_put(message_pool, msg);
-    }
+    complete_msg(msg);
 }
 
 static inline int
 process_msg_ring(uint16_t proc_id, struct rte_mbuf **pkts_burst)
 {
     /* read msg from ring buf and to process */
+    struct ff_msg *msg;
+    uint64_t start_tsc;
     uint16_t nb_rb;
     int i;
 
-    nb_rb = rte_ring_dequeue_burst(msg_ring[proc_id].ring[0],
+    nb_rb = rte_ring_dequeue_burst(msg_ring[proc_id].ring,
         (void **)pkts_burst, MAX_PKT_BURST, NULL);
 
     if (likely(nb_rb == 0))
         return 0;
 
+    start_tsc = rte_rdtsc();
     for (i = 0; i < nb_rb; ++i) {
-        handle_msg((struct ff_msg *)pkts_burst[i], proc_id);
+        msg = (struct ff_msg *)pkts_burst[i];
+        /* the requester's tsc, only meaningful with an invariant tsc */
+        if (likely(msg->send_tsc < start_tsc)) {
+            lcore_stats->msg_wait_tsc += start_tsc - msg->send_tsc;
+        }
+        handle_msg(msg);
     }
 
+    lcore_stats->msgs += nb_rb;
+    lcore_stats->msg_handle_tsc += rte_rdtsc() - start_tsc;
+
     return 0;
 }
 
@@ -1772,24 +2439,22 @@ send_burst(struct lcore_conf *qconf, uint16_t n, uint8_t port)
     m_table = (struct rte_mbuf **)qconf->tx_mbufs[port].m_table;
 
     if (unlikely(ff_global_cfg.pcap.enable)) {
-        uint16_t i;
-        for (i = 0; i < n; i++) {
-            ff_dump_packets( ff_global_cfg.pcap.save_path, m_table[i],
-               ff_global_cfg.pcap.snap_len, ff_global_cfg.pcap.save_len);
-        }
+        ff_dump_packets(port, queueid, m_table, n, 1);
     }
 
     ret = rte_eth_tx_burst(port, queueid, m_table, n);
-    ff_traffic.tx_packets += ret;
+    lcore_stats->tx_bursts++;
+    lcore_stats->traffic.tx_packets += ret;
     uint16_t i;
     for (i = 0; i < ret; i++) {
-        ff_traffic.tx_bytes += rte_pktmbuf_pkt_len(m_table[i]);
+        lcore_stats->traffic.tx_bytes += rte_pktmbuf_pkt_len(m_table[i]);
 #ifdef FF_USE_PAGE_ARRAY
         if (qconf->tx_mbufs[port].bsd_m_table[i])
             ff_enq_tx_bsdmbuf(port, qconf->tx_mbufs[port].bsd_m_table[i], m_table[i]->nb_segs);
 #endif
     }
     if (unlikely(ret < n)) {
+        lcore_stats->drops[FF_DROP_TX_FULL] += n - ret;
         do {
             rte_pktmbuf_free(m_table[ret]);
 #ifdef FF_USE_PAGE_ARRAY
@@ -1801,6 +2466,388 @@ send_burst(struct lcore_conf *qconf, uint16_t n, uint8_t port)
     return 0;
 }
 
+/*
+ * Work out the real l2/l3 lengths of an outgoing packet, VLAN/QinQ tags
+ * included, and mark it IPv4 or IPv6. Returns the L4 protocol, or 0 if
+ * it is neither.
+ */
+static inline uint8_t
+tx_offload_parse(struct rte_mbuf *head)
+{
+    char *data = rte_pktmbuf_mtod(head, char *);
+    struct rte_ether_hdr *eh = (struct rte_ether_hdr *)data;
+    uint16_t ether_type = eh->ether_type;
+    uint16_t l2_len = RTE_ETHER_HDR_LEN;
+
+    while (ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_VLAN) ||
+        ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_QINQ)) {
+        struct rte_vlan_hdr *vh = (struct rte_vlan_hdr *)(data + l2_len);
+        ether_type = vh->eth_proto;
+        l2_len += sizeof(struct rte_vlan_hdr);
+    }
+
+    head->l2_len = l2_len;
+
+    if (ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4)) {
+        struct rte_ipv4_hdr *iph = (struct rte_ipv4_hdr *)(data + l2_len);
+        head->l3_len = (iph->version_ihl & 0x0f) << 2;
+        head->ol_flags |= RTE_MBUF_F_TX_IPV4;
+        return iph->next_proto_id;
+    }
+
+    if (ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6)) {
+        /* the stack doesn't put extension headers before tcp/udp it offloads */
+        struct rte_ipv6_hdr *ip6h = (struct rte_ipv6_hdr *)(data + l2_len);
+        head->l3_len = sizeof(struct rte_ipv6_hdr);
+        head->ol_flags |= RTE_MBUF_F_TX_IPV6;
+        return ip6h->proto;
+    }
+
+    return 0;
+}
+
+/*
+ * Fill in the TX offload request of a packet built from a stack mbuf.
+ * The stack has already seeded the L4 checksum with the pseudo header,
+ * only TSO needs it again without the payload length.
+ */
+void
+ff_tx_offload_set(struct ff_dpdk_if_context *ctx, struct rte_mbuf *head,
+    const struct ff_tx_offload *offload)
+{
+    uint8_t proto;
+    char *l3h;
+
+    if (!offload->ip_csum && !offload->tcp_csum && !offload->udp_csum &&
+        !offload->tso_seg_size) {
+        return;
+    }
+
+    proto = tx_offload_parse(head);
+    if (proto == 0) {
+        return;
+    }
+
+    l3h = rte_pktmbuf_mtod_offset(head, char *, head->l2_len);
+
+    if (offload->ip_csum && (head->ol_flags & RTE_MBUF_F_TX_IPV4)) {
+        head->ol_flags |= RTE_MBUF_F_TX_IP_CKSUM;
+    }
+
+    if (!ctx->hw_features.tx_csum_l4) {
+        return;
+    }
+
+    if (offload->tcp_csum && proto == IPPROTO_TCP) {
+        head->ol_flags |= RTE_MBUF_F_TX_TCP_CKSUM;
+    }
+
+    /*
+     *  TCP segmentation offload.
+     *
+     *  - set the PKT_TX_TCP_SEG flag in mbuf->ol_flags (this flag
+     *    implies PKT_TX_TCP_CKSUM)
+     *  - set the flag PKT_TX_IPV4 or PKT_TX_IPV6
+     *  - if it's IPv4, set the PKT_TX_IP_CKSUM flag and
+     *    write the IP checksum to 0 in the packet
+     *  - fill the mbuf offload information: l2_len,
+     *    l3_len, l4_len, tso_segsz
+     *  - calculate the pseudo header checksum without taking ip_len
+     *    in account, and set it in the TCP header. Refer to
+     *    rte_ipv4_phdr_cksum() and rte_ipv6_phdr_cksum() that can be
+     *    used as helpers.
+     */
+    if (offload->tso_seg_size && proto == IPPROTO_TCP) {
+        struct rte_tcp_hdr *tcph;
+        tcph = (struct rte_tcp_hdr *)(l3h + head->l3_len);
+
+        head->ol_flags |= RTE_MBUF_F_TX_TCP_SEG;
+        if (head->ol_flags & RTE_MBUF_F_TX_IPV4) {
+            tcph->cksum = rte_ipv4_phdr_cksum(
+                (struct rte_ipv4_hdr *)l3h, head->ol_flags);
+        } else {
+            tcph->cksum = rte_ipv6_phdr_cksum(
+                (struct rte_ipv6_hdr *)l3h, head->ol_flags);
+        }
+
+        head->l4_len = (tcph->data_off & 0xf0) >> 2;
+        head->tso_segsz = offload->tso_seg_size;
+    }
+
+    if (offload->udp_csum && proto == IPPROTO_UDP) {
+        head->ol_flags |= RTE_MBUF_F_TX_UDP_CKSUM;
+    }
+}
+
+/*
+ * GSO doesn't touch checksums, fix them up per segment,
+ * by the NIC if it can do it, else in software.
+ */
+static inline void
+gso_segment_cksum(struct ff_dpdk_if_context *ctx, struct rte_mbuf *seg)
+{
+    struct rte_ipv4_hdr *iph;
+    struct rte_tcp_hdr *tcph;
+    uint32_t l4_off = seg->l2_len + seg->l3_len;
+
+    iph = rte_pktmbuf_mtod_offset(seg, struct rte_ipv4_hdr *, seg->l2_len);
+    tcph = rte_pktmbuf_mtod_offset(seg, struct rte_tcp_hdr *, l4_off);
+
+    seg->ol_flags &= ~(RTE_MBUF_F_TX_IP_CKSUM | RTE_MBUF_F_TX_TCP_CKSUM);
+
+    iph->hdr_checksum = 0;
+    if (ctx->hw_features.tx_csum_ip) {
+        seg->ol_flags |= RTE_MBUF_F_TX_IP_CKSUM;
+    } else {
+        iph->hdr_checksum = rte_ipv4_cksum(iph);
+    }
+
+    if (ctx->hw_features.tx_csum_l4) {
+        seg->ol_flags |= RTE_MBUF_F_TX_TCP_CKSUM;
+        tcph->cksum = rte_ipv4_phdr_cksum(iph, seg->ol_flags);
+    } else {
+        uint16_t raw = 0;
+        uint32_t sum;
+
+        tcph->cksum = 0;
+        rte_raw_cksum_mbuf(seg, l4_off, seg->pkt_len - l4_off, &raw);
+        sum = (uint32_t)raw + rte_ipv4_phdr_cksum(iph, 0);
+        sum = (sum & 0xffff) + (sum >> 16);
+        sum = (sum & 0xffff) + (sum >> 16);
+        tcph->cksum = (sum == 0xffff) ? sum : (uint16_t)~sum;
+    }
+}
+
+/*
+ * Software TSO: cut a TSO sized IPv4/TCP packet into MSS sized segments
+ * with librte_gso. Each segment is a copy of the headers plus an indirect
+ * mbuf pointing into the payload of the original packet.
+ */
+static int
+gso_send_packet(struct ff_dpdk_if_context *ctx, struct rte_mbuf *head,
+    uint16_t mss)
+{
+    struct rte_mbuf *segs[GSO_MAX_SEGS];
+    struct rte_gso_ctx gso_ctx;
+    struct rte_tcp_hdr *tcph;
+    int i, nb_segs;
+
+    if (tx_offload_parse(head) != IPPROTO_TCP ||
+        !(head->ol_flags & RTE_MBUF_F_TX_IPV4)) {
+        rte_pktmbuf_free(head);
+        return -1;
+    }
+    tcph = rte_pktmbuf_mtod_offset(head, struct rte_tcp_hdr *,
+        head->l2_len + head->l3_len);
+    head->l4_len = (tcph->data_off & 0xf0) >> 2;
+    head->ol_flags |= RTE_MBUF_F_TX_TCP_SEG;
+
+    gso_ctx.direct_pool = pktmbuf_pool[lcore_conf.socket_id];
+    gso_ctx.indirect_pool = gso_indirect_pool[lcore_conf.socket_id];
+    gso_ctx.gso_types = RTE_ETH_TX_OFFLOAD_TCP_TSO;
+    gso_ctx.gso_size = head->l2_len + head->l3_len + head->l4_len + mss;
+    gso_ctx.flag = 0;
+
+    nb_segs = rte_gso_segment(head, &gso_ctx, segs, GSO_MAX_SEGS);
+    if (nb_segs < 0) {
+        if (nb_segs == -ENOMEM) {
+            mbuf_nomem_drop(FF_DROP_TX_NOMEM);
+        }
+        rte_pktmbuf_free(head);
+        return -1;
+    }
+
+    if (nb_segs == 0) {
+        /* not larger than one segment */
+        segs[0] = head;
+        nb_segs = 1;
+    } else {
+        /* the segments hold their own references to the payload */
+        rte_pktmbuf_free(head);
+    }
+
+    for (i = 0; i < nb_segs; i++) {
+        gso_segment_cksum(ctx, segs[i]);
+        send_single_packet(segs[i], ctx->port_id);
+    }
+
+    return 0;
+}
+
+static void
+zc_tx_ref_free(void *addr __rte_unused, void *opaque)
+{
+    struct zc_tx_ref *ref = (struct zc_tx_ref *)opaque;
+
+    ff_mbuf_free(ref->m);
+    rte_mempool_put(ref->pool, ref);
+}
+
+/* IOVA of a stack buffer if the NIC can DMA from it, else RTE_BAD_IOVA */
+static inline rte_iova_t
+zc_tx_iova(void *data, unsigned len)
+{
+    static const struct rte_memseg_list *last_msl;
+    const struct rte_memseg_list *msl = last_msl;
+    const struct rte_memseg *ms;
+
+    if (msl == NULL || data < msl->base_va ||
+        RTE_PTR_ADD(data, len) > RTE_PTR_ADD(msl->base_va, msl->len)) {
+        msl = rte_mem_virt2memseg_list(data);
+        if (msl == NULL) {
+            return RTE_BAD_IOVA;
+        }
+        last_msl = msl;
+    }
+
+    if (rte_eal_iova_mode() == RTE_IOVA_VA) {
+        return (rte_iova_t)(uintptr_t)data;
+    }
+
+    /* physically contiguous only within one memseg */
+    ms = rte_mem_virt2memseg(data, msl);
+    if (ms == NULL || ms->iova == RTE_BAD_IOVA ||
+        RTE_PTR_ADD(data, len) > RTE_PTR_ADD(ms->addr, ms->len)) {
+        return RTE_BAD_IOVA;
+    }
+
+    return ms->iova + RTE_PTR_DIFF(data, ms->addr);
+}
+
+static inline void
+zc_tx_append(struct rte_mbuf *head, struct rte_mbuf **tail,
+    struct rte_mbuf *cur)
+{
+    if (*tail != NULL) {
+        (*tail)->next = cur;
+        head->nb_segs++;
+    }
+    *tail = cur;
+}
+
+/*
+ * Build the rte_mbuf chain of a stack packet without copying its payload.
+ * The first segment holds the headers and is always copied, the offload
+ * setup writes into them. Frees the stack mbuf chain on failure.
+ */
+static struct rte_mbuf *
+zc_tx_build(void *m, int total)
+{
+    struct rte_mempool *mbuf_pool = pktmbuf_pool[lcore_conf.socket_id];
+    struct rte_mbuf *head, *tail = NULL, *cur;
+    struct zc_tx_ref *ref = NULL;
+    uint16_t nb_ext = 0;
+    void *bsd = m, *data;
+    unsigned len;
+
+    head = rte_pktmbuf_alloc(mbuf_pool);
+    if (head == NULL) {
+        ff_mbuf_free(m);
+        return NULL;
+    }
+    zc_tx_append(head, &tail, head);
+
+    while (bsd != NULL) {
+        ff_next_mbuf(&bsd, &data, &len);
+        if (len == 0) {
+            continue;
+        }
+
+        rte_iova_t iova = RTE_BAD_IOVA;
+        if (rte_pktmbuf_data_len(head) > 0 && len >= ZC_TX_MIN_LEN) {
+            iova = zc_tx_iova(data, len);
+        }
+
+        if (iova != RTE_BAD_IOVA) {
+            if (ref == NULL) {
+                struct rte_mempool *ref_pool = zc_tx_ref_pool[lcore_conf.socket_id];
+                if (rte_mempool_get(ref_pool, (void **)&ref) < 0) {
+                    goto fail;
+                }
+                ref->pool = ref_pool;
+                ref->m = m;
+                ref->shinfo.free_cb = zc_tx_ref_free;
+                ref->shinfo.fcb_opaque = ref;
+                rte_mbuf_ext_refcnt_set(&ref->shinfo, 0);
+            }
+
+            cur = rte_pktmbuf_alloc(mbuf_pool);
+            if (cur == NULL) {
+                goto fail;
+            }
+
+            rte_mbuf_ext_refcnt_update(&ref->shinfo, 1);
+            nb_ext++;
+            rte_pktmbuf_attach_extbuf(cur, data, iova, len, &ref->shinfo);
+            cur->data_len = len;
+            zc_tx_append(head, &tail, cur);
+            continue;
+        }
+
+        while (len > 0) {
+            if (RTE_MBUF_HAS_EXTBUF(tail) || rte_pktmbuf_tailroom(tail) == 0) {
+                cur = rte_pktmbuf_alloc(mbuf_pool);
+                if (cur == NULL) {
+                    goto fail;
+                }
+                zc_tx_append(head, &tail, cur);
+            }
+
+            unsigned n = RTE_MIN(len, (unsigned)rte_pktmbuf_tailroom(tail));
+            rte_memcpy(rte_pktmbuf_mtod_offset(tail, char *, tail->data_len),
+                data, n);
+            tail->data_len += n;
+            data = RTE_PTR_ADD(data, n);
+            len -= n;
+        }
+    }
+
+    head->pkt_len = total;
+
+    if (nb_ext == 0) {
+        if (ref != NULL) {
+            rte_mempool_put(ref->pool, ref);
+        }
+        ff_mbuf_free(m);
+    }
+
+    return head;
+
+fail:
+    if (nb_ext == 0) {
+        if (ref != NULL) {
+            rte_mempool_put(ref->pool, ref);
+        }
+        ff_mbuf_free(m);
+    }
+    /* with external segments, the last one freed releases the stack mbuf */
+    rte_pktmbuf_free(head);
+    return NULL;
+}
+
+static int
+zc_tx_send(struct ff_dpdk_if_context *ctx, void *m, int total)
+{
+    struct ff_tx_offload offload = {0};
+    struct rte_mbuf *head;
+
+    ff_mbuf_tx_offload(m, &offload);
+
+    head = zc_tx_build(m, total);
+    if (head == NULL) {
+        mbuf_nomem_drop(FF_DROP_TX_NOMEM);
+        return -1;
+    }
+
+    if (offload.tso_seg_size && ctx->hw_features.tx_soft_tso) {
+        return gso_send_packet(ctx, head, offload.tso_seg_size);
+    }
+
+    ff_tx_offload_set(ctx, head, &offload);
+
+    return send_single_packet(head, ctx->port_id);
+}
+
 /* Enqueue a single packet, and send burst if queue is filled */
 static inline int
 send_single_packet(struct rte_mbuf *m, uint8_t port)
@@ -1839,9 +2886,15 @@ ff_dpdk_if_send(struct ff_dpdk_if_context *ctx, void *m,
     qconf->tx_mbufs[ctx->port_id].len = len;
     return 0;
 #endif
-    struct rte_mempool *mbuf_pool = pktmbuf_pool[lcore_conf.socket_id];
+    if (tx_zerocopy) {
+        return zc_tx_send(ctx, m, total);
+    }
+
+    const struct mbuf_pool *pool = mbuf_pool_fit(lcore_conf.socket_id, total);
+    struct rte_mempool *mbuf_pool = pool->mp;
     struct rte_mbuf *head = rte_pktmbuf_alloc(mbuf_pool);
     if (head == NULL) {
+        mbuf_nomem_drop(FF_DROP_TX_NOMEM);
         ff_mbuf_free(m);
         return -1;
     }
@@ -1855,6 +2908,7 @@ ff_dpdk_if_send(struct ff_dpdk_if_context *ctx, void *m,
         if (cur == NULL) {
             cur = rte_pktmbuf_alloc(mbuf_pool);
             if (cur == NULL) {
+                mbuf_nomem_drop(FF_DROP_TX_NOMEM);
                 rte_pktmbuf_free(head);
                 ff_mbuf_free(m);
                 return -1;
@@ -1868,7 +2922,7 @@ ff_dpdk_if_send(struct ff_dpdk_if_context *ctx, void *m,
 
         prev = cur;
         void *data = rte_pktmbuf_mtod(cur, void*);
-        int len = total > RTE_MBUF_DEFAULT_DATAROOM ? RTE_MBUF_DEFAULT_DATAROOM : total;
+        int len = total > pool->data_size ? pool->data_size : total;
         int ret = ff_mbuf_copydata(m, data, off, len);
         if (ret < 0) {
             rte_pktmbuf_free(head);
@@ -1886,69 +2940,93 @@ ff_dpdk_if_send(struct ff_dpdk_if_context *ctx, void *m,
     struct ff_tx_offload offload = {0};
     ff_mbuf_tx_offload(m, &offload);
 
-    void *data = rte_pktmbuf_mtod(head, void*);
+    if (offload.tso_seg_size && ctx->hw_features.tx_soft_tso) {
+        ff_mbuf_free(m);
+        return gso_send_packet(ctx, head, offload.tso_seg_size);
+    }
 
-    if (offload.ip_csum) {
-        /* ipv6 not supported yet */
-        struct rte_ipv4_hdr *iph;
-        int iph_len;
-        iph = (struct rte_ipv4_hdr *)(data + RTE_ETHER_HDR_LEN);
-        iph_len = (iph->version_ihl & 0x0f) << 2;
+    ff_tx_offload_set(ctx, head, &offload);
 
-        head->ol_flags |= RTE_MBUF_F_TX_IP_CKSUM | RTE_MBUF_F_TX_IPV4;
-        head->l2_len = RTE_ETHER_HDR_LEN;
-        head->l3_len = iph_len;
-    }
+    ff_mbuf_free(m);
 
-    if (ctx->hw_features.tx_csum_l4) {
-        struct rte_ipv4_hdr *iph;
-        int iph_len;
-        iph = (struct rte_ipv4_hdr *)(data + RTE_ETHER_HDR_LEN);
-        iph_len = (iph->version_ihl & 0x0f) << 2;
+    return send_single_packet(head, ctx->port_id);
+}
 
-        if (offload.tcp_csum) {
-            head->ol_flags |= RTE_MBUF_F_TX_TCP_CKSUM;
-            head->l2_len = RTE_ETHER_HDR_LEN;
-            head->l3_len = iph_len;
-        }
+/*
+ * The loop callback is the only caller of ff_epoll_wait/ff_kevent/ff_poll,
+ * so with loop_wait a call that found nothing registers its deadline here,
+ * and main_loop() holds the callback back until an event is queued
+ * (ff_loop_wakeup) or the earliest deadline of this round expires.
+ */
+static struct {
+    int waiting;
+    int wakeup;
+    uint64_t deadline_tsc;
+} loop_waiter;
 
-        /*
-         *  TCP segmentation offload.
-         *
-         *  - set the PKT_TX_TCP_SEG flag in mbuf->ol_flags (this flag
-         *    implies PKT_TX_TCP_CKSUM)
-         *  - set the flag PKT_TX_IPV4 or PKT_TX_IPV6
-         *  - if it's IPv4, set the PKT_TX_IP_CKSUM flag and
-         *    write the IP checksum to 0 in the packet
-         *  - fill the mbuf offload information: l2_len,
-         *    l3_len, l4_len, tso_segsz
-         *  - calculate the pseudo header checksum without taking ip_len
-         *    in account, and set it in the TCP header. Refer to
-         *    rte_ipv4_phdr_cksum() and rte_ipv6_phdr_cksum() that can be
-         *    used as helpers.
-         */
-        if (offload.tso_seg_size) {
-            struct rte_tcp_hdr *tcph;
-            int tcph_len;
-            tcph = (struct rte_tcp_hdr *)((char *)iph + iph_len);
-            tcph_len = (tcph->data_off & 0xf0) >> 2;
-            tcph->cksum = rte_ipv4_phdr_cksum(iph, RTE_MBUF_F_TX_TCP_SEG);
+void
+ff_loop_wait(int64_t timeout_ns)
+{
+    uint64_t hz, tsc;
 
-            head->ol_flags |= RTE_MBUF_F_TX_TCP_SEG;
-            head->l4_len = tcph_len;
-            head->tso_segsz = offload.tso_seg_size;
-        }
+    if (!loop_wait)
+        return;
 
-        if (offload.udp_csum) {
-            head->ol_flags |= RTE_MBUF_F_TX_UDP_CKSUM;
-            head->l2_len = RTE_ETHER_HDR_LEN;
-            head->l3_len = iph_len;
-        }
+    if (timeout_ns < 0) {
+        tsc = UINT64_MAX;
+    } else {
+        hz = rte_get_tsc_hz();
+        tsc = rte_rdtsc() + timeout_ns / NS_PER_S * hz +
+            timeout_ns % NS_PER_S * hz / NS_PER_S;
     }
 
-    ff_mbuf_free(m);
+    if (!loop_waiter.waiting || tsc < loop_waiter.deadline_tsc)
+        loop_waiter.deadline_tsc = tsc;
+    loop_waiter.waiting = 1;
+}
 
-    return send_single_packet(head, ctx->port_id);
+void
+ff_loop_wakeup(void)
+{
+    loop_waiter.wakeup = 1;
+}
+
+static inline int
+loop_ready(int idle, uint64_t cur_tsc, uint64_t usch_tsc, uint64_t drain_tsc)
+{
+    if (loop_waiter.waiting)
+        return loop_waiter.wakeup || cur_tsc >= loop_waiter.deadline_tsc;
+
+    return !idle || cur_tsc - usch_tsc >= drain_tsc;
+}
+
+/* An idle wait must end by the next stack clock tick and a waiter's deadline. */
+static inline uint64_t
+loop_idle_deadline(void)
+{
+    if (loop_waiter.wakeup)
+        return 0;
+
+    if (loop_waiter.waiting)
+        return RTE_MIN(loop_waiter.deadline_tsc, freebsd_clock.expire);
+
+    return freebsd_clock.expire;
+}
+
+/* Don't sleep past the deadline of a waiter, nor with an event pending. */
+static inline unsigned
+loop_idle_sleep(uint64_t cur_tsc)
+{
+    uint64_t left;
+
+    if (!loop_waiter.waiting || loop_waiter.deadline_tsc == UINT64_MAX)
+        return loop_waiter.wakeup ? 0 : idle_sleep;
+
+    if (loop_waiter.wakeup || loop_waiter.deadline_tsc <= cur_tsc)
+        return 0;
+
+    left = (loop_waiter.deadline_tsc - cur_tsc) * US_PER_S / rte_get_tsc_hz();
+    return RTE_MIN(left, (uint64_t)idle_sleep);
 }
 
 static int
@@ -1958,7 +3036,9 @@ main_loop(void *arg)
 
     struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
     uint64_t prev_tsc, diff_tsc, cur_tsc, usch_tsc, div_tsc, usr_tsc, sys_tsc, end_tsc, idle_sleep_tsc;
-    int i, j, nb_rx, idle;
+    uint64_t rx_tsc;
+    int i, nb_rx, idle, power;
+    unsigned sleep_us;
     uint16_t port_id, queue_id;
     struct lcore_conf *qconf;
     uint64_t drain_tsc = 0;
@@ -1973,10 +3053,19 @@ main_loop(void *arg)
 
     qconf = &lcore_conf;
 
+    lcore_stats->lcore_id = rte_lcore_id();
+    lcore_stats->active = 1;
+
+    ff_power_init();
+    power = ff_power_enabled();
+
     while (1) {
         cur_tsc = rte_rdtsc();
         if (unlikely(freebsd_clock.expire < cur_tsc)) {
             rte_timer_manage();
+            if (unlikely(latency_hist)) {
+                latency_record(FF_LATENCY_TIMER, rte_rdtsc() - cur_tsc);
+            }
         }
 
         idle = 1;
@@ -2023,27 +3112,20 @@ main_loop(void *arg)
 
             nb_rx = rte_eth_rx_burst(port_id, queue_id, pkts_burst,
                 MAX_PKT_BURST);
-            if (nb_rx == 0)
+            if (nb_rx == 0) {
+                lcore_stats->rx_empty_polls++;
                 continue;
+            }
 
             idle = 0;
+            lcore_stats->rx_bursts++;
 
-            /* Prefetch first packets */
-            for (j = 0; j < PREFETCH_OFFSET && j < nb_rx; j++) {
-                rte_prefetch0(rte_pktmbuf_mtod(
-                        pkts_burst[j], void *));
-            }
+            rx_tsc = unlikely(latency_hist) ? rte_rdtsc() : 0;
 
-            /* Prefetch and handle already prefetched packets */
-            for (j = 0; j < (nb_rx - PREFETCH_OFFSET); j++) {
-                rte_prefetch0(rte_pktmbuf_mtod(pkts_burst[
-                        j + PREFETCH_OFFSET], void *));
-                process_packets(port_id, queue_id, &pkts_burst[j], 1, ctx, 0);
-            }
+            process_packets(port_id, queue_id, pkts_burst, nb_rx, ctx, 0);
 
-            /* Handle remaining prefetched packets */
-            for (; j < nb_rx; j++) {
-                process_packets(port_id, queue_id, &pkts_burst[j], 1, ctx, 0);
+            if (unlikely(latency_hist)) {
+                latency_record(FF_LATENCY_RX, rte_rdtsc() - rx_tsc);
             }
         }
 
@@ -2051,17 +3133,30 @@ main_loop(void *arg)
 
         div_tsc = rte_rdtsc();
 
-        if (likely(lr->loop != NULL && (!idle || cur_tsc - usch_tsc >= drain_tsc))) {
+        if (likely(lr->loop != NULL && loop_ready(idle, cur_tsc, usch_tsc, drain_tsc))) {
             usch_tsc = cur_tsc;
+            loop_waiter.waiting = 0;
+            loop_waiter.wakeup = 0;
             lr->loop(lr->arg);
+            if (unlikely(latency_hist)) {
+                latency_record(FF_LATENCY_USER, rte_rdtsc() - div_tsc);
+            }
         }
 
         idle_sleep_tsc = rte_rdtsc();
-        if (likely(idle && idle_sleep)) {
-            usleep(idle_sleep);
-            end_tsc = rte_rdtsc();
+        if (unlikely(latency_hist)) {
+            latency_record(FF_LATENCY_LOOP, idle_sleep_tsc - cur_tsc);
+        }
+        if (power) {
+            end_tsc = ff_power_idle(idle, idle_sleep_tsc, loop_idle_deadline());
         } else {
-            end_tsc = idle_sleep_tsc;
+            sleep_us = idle ? loop_idle_sleep(idle_sleep_tsc) : 0;
+            if (likely(sleep_us)) {
+                usleep(sleep_us);
+                end_tsc = rte_rdtsc();
+            } else {
+                end_tsc = idle_sleep_tsc;
+            }
         }
 
         usr_tsc = usr_cb_tsc;
@@ -2071,14 +3166,14 @@ main_loop(void *arg)
 
         if (!idle) {
             sys_tsc = div_tsc - cur_tsc - usr_cb_tsc;
-            ff_top_status.sys_tsc += sys_tsc;
+            lcore_stats->top.sys_tsc += sys_tsc;
         }
 
-        ff_top_status.usr_tsc += usr_tsc;
-        ff_top_status.work_tsc += end_tsc - cur_tsc;
-        ff_top_status.idle_tsc += end_tsc - cur_tsc - usr_tsc - sys_tsc;
+        lcore_stats->top.usr_tsc += usr_tsc;
+        lcore_stats->top.work_tsc += end_tsc - cur_tsc;
+        lcore_stats->top.idle_tsc += end_tsc - cur_tsc - usr_tsc - sys_tsc;
 
-        ff_top_status.loops++;
+        lcore_stats->top.loops++;
     }
 
     return 0;
@@ -2118,27 +3213,234 @@ ff_dpdk_pktmbuf_free(void *m)
     rte_pktmbuf_free_seg((struct rte_mbuf *)m);
 }
 
+/*
+ * Toeplitz hash of the IPv4/IPv6 4-tuple with a precomputed key schedule:
+ * the hash is the XOR of the 32-bit key windows at each set bit of the
+ * input, so the contribution of every (input byte position, byte value)
+ * is tabulated once and a hash is one lookup per input byte instead of
+ * eight bit steps.
+ */
+#define TOEPLITZ_TUPLE_LEN 12
+#define TOEPLITZ_TUPLE6_LEN 36
+
+static uint32_t toeplitz_tbl[TOEPLITZ_TUPLE6_LEN][256];
+static const uint8_t *toeplitz_tbl_key;
+
 static uint32_t
-toeplitz_hash(unsigned keylen, const uint8_t *key,
-    unsigned datalen, const uint8_t *data)
+toeplitz_key_window(unsigned keylen, const uint8_t *key, unsigned bit)
 {
-    uint32_t hash = 0, v;
-    u_int i, b;
+    uint32_t v = 0;
+    unsigned i, k;
 
-    /* XXXRW: Perhaps an assertion about key length vs. data length? */
+    for (i = 0; i < 32; i++) {
+        k = bit + i;
+        v <<= 1;
+        if (k / 8 < keylen && (key[k / 8] & (0x80 >> (k % 8))))
+            v |= 1;
+    }
 
-    v = (key[0]<<24) + (key[1]<<16) + (key[2] <<8) + key[3];
-    for (i = 0; i < datalen; i++) {
-        for (b = 0; b < 8; b++) {
-            if (data[i] & (1<<(7-b)))
-                hash ^= v;
-            v <<= 1;
-            if ((i + 4) < keylen &&
-                (key[i+4] & (1<<(7-b))))
-                v |= 1;
+    return v;
+}
+
+static void
+toeplitz_tbl_init(unsigned keylen, const uint8_t *key)
+{
+    uint32_t window[8];
+    unsigned i, b, val;
+
+    for (i = 0; i < TOEPLITZ_TUPLE6_LEN; i++) {
+        for (b = 0; b < 8; b++)
+            window[b] = toeplitz_key_window(keylen, key, i * 8 + b);
+
+        for (val = 0; val < 256; val++) {
+            toeplitz_tbl[i][val] = 0;
+            for (b = 0; b < 8; b++) {
+                if (val & (0x80 >> b))
+                    toeplitz_tbl[i][val] ^= window[b];
+            }
         }
     }
-    return (hash);
+
+    toeplitz_tbl_key = key;
+}
+
+static inline uint32_t
+toeplitz_hash(const uint8_t *data, unsigned len)
+{
+    uint32_t hash = 0;
+    unsigned i;
+
+    for (i = 0; i < len; i++)
+        hash ^= toeplitz_tbl[i][data[i]];
+
+    return hash;
+}
+
+/* The queue the NIC would pick for `hash` with its default reta */
+static inline uint16_t
+rss_hash_queue(uint16_t port_id, uint32_t hash, uint16_t nb_queues)
+{
+    uint16_t reta_size = rss_reta_size[port_id];
+
+    return (hash & (reta_size - 1)) % nb_queues;
+}
+
+/*
+ * Software RSS, for NICs that can't spread flows over their queues.
+ *
+ * The input tuple is built like the hardware does and like ff_rss_check()
+ * expects for the flows it opens: addresses then ports of the received
+ * packet, in network order. Fragments and other protocols are hashed on
+ * the addresses only. An ICMP error is hashed on the packet it quotes,
+ * with source and destination swapped, to reach the queue of its flow.
+ *
+ * Returns the length of the tuple, 0 if the packet isn't IP.
+ */
+static unsigned soft_rss_tuple(const uint8_t *l3, unsigned len,
+    uint16_t ether_type, uint8_t *tuple, int quoted);
+
+static unsigned
+soft_rss_l4(uint8_t proto, const uint8_t *l4, unsigned len, uint8_t *tuple,
+    unsigned addrs_len, int quoted)
+{
+    switch (proto) {
+    case IPPROTO_TCP:
+    case IPPROTO_UDP:
+    case IPPROTO_SCTP:
+        if (len < 4)
+            break;
+        if (quoted) {
+            memcpy(&tuple[addrs_len], &l4[2], 2);
+            memcpy(&tuple[addrs_len + 2], &l4[0], 2);
+        } else {
+            memcpy(&tuple[addrs_len], l4, 4);
+        }
+        return addrs_len + 4;
+
+    case IPPROTO_ICMP:
+        if (quoted || len < ICMP_MINLEN || addrs_len != 8)
+            break;
+        switch (l4[0]) {
+        case ICMP_DEST_UNREACH:
+        case ICMP_SOURCE_QUENCH:
+        case ICMP_REDIRECT:
+        case ICMP_TIME_EXCEEDED:
+        case ICMP_PARAMETERPROB:
+            return soft_rss_tuple(l4 + ICMP_MINLEN, len - ICMP_MINLEN,
+                RTE_ETHER_TYPE_IPV4, tuple, 1) ?: addrs_len;
+        }
+        break;
+
+    case IPPROTO_ICMPV6:
+        if (quoted || len < sizeof(struct icmp6_hdr) || addrs_len != 32)
+            break;
+        /* NDP stays on this queue, which shares it with all the others */
+        if (l4[0] >= ND_ROUTER_SOLICIT && l4[0] <= ND_REDIRECT)
+            return 0;
+        if (l4[0] < ICMP6_ECHO_REQUEST) {
+            return soft_rss_tuple(l4 + sizeof(struct icmp6_hdr),
+                len - sizeof(struct icmp6_hdr), RTE_ETHER_TYPE_IPV6,
+                tuple, 1) ?: addrs_len;
+        }
+        break;
+    }
+
+    return addrs_len;
+}
+
+static unsigned
+soft_rss_tuple(const uint8_t *l3, unsigned len, uint16_t ether_type,
+    uint8_t *tuple, int quoted)
+{
+    if (ether_type == RTE_ETHER_TYPE_IPV4) {
+        const struct rte_ipv4_hdr *iph = (const struct rte_ipv4_hdr *)l3;
+        unsigned hlen;
+
+        if (len < sizeof(*iph))
+            return 0;
+        hlen = (iph->version_ihl & RTE_IPV4_HDR_IHL_MASK) *
+            RTE_IPV4_IHL_MULTIPLIER;
+        if (hlen < sizeof(*iph) || hlen > len)
+            return 0;
+
+        memcpy(&tuple[0], quoted ? &iph->dst_addr : &iph->src_addr, 4);
+        memcpy(&tuple[4], quoted ? &iph->src_addr : &iph->dst_addr, 4);
+
+        if (iph->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG |
+            RTE_IPV4_HDR_OFFSET_MASK))
+            return 8;
+
+        return soft_rss_l4(iph->next_proto_id, l3 + hlen, len - hlen,
+            tuple, 8, quoted);
+    }
+
+    if (ether_type == RTE_ETHER_TYPE_IPV6) {
+        const struct rte_ipv6_hdr *ip6h = (const struct rte_ipv6_hdr *)l3;
+        unsigned off = sizeof(*ip6h);
+        uint8_t proto;
+
+        if (len < sizeof(*ip6h))
+            return 0;
+
+        memcpy(&tuple[0], quoted ? ip6h->dst_addr : ip6h->src_addr, 16);
+        memcpy(&tuple[16], quoted ? ip6h->src_addr : ip6h->dst_addr, 16);
+
+        proto = ip6h->proto;
+        while (proto == IPPROTO_HOPOPTS || proto == IPPROTO_ROUTING ||
+            proto == IPPROTO_DSTOPTS) {
+            if (off + 8 > len)
+                return 32;
+            proto = l3[off];
+            off += (l3[off + 1] + 1) * 8;
+        }
+        if (proto == IPPROTO_FRAGMENT || off > len)
+            return 32;
+
+        return soft_rss_l4(proto, l3 + off, len - off, tuple, 32, quoted);
+    }
+
+    return 0;
+}
+
+static void
+soft_rss_dispatch(uint16_t port_id, void **data, const uint16_t *lens,
+    int *queues, uint16_t count, uint16_t queue_id, uint16_t nb_queues)
+{
+    uint8_t tuple[TOEPLITZ_TUPLE6_LEN];
+    uint16_t i;
+
+    if (unlikely(toeplitz_tbl_key != rsskey)) {
+        toeplitz_tbl_init(rsskey_len, rsskey);
+    }
+
+    for (i = 0; i < count; i++) {
+        const uint8_t *pkt = data[i];
+        const struct rte_ether_hdr *eth = (const struct rte_ether_hdr *)pkt;
+        unsigned len = lens[i], off = sizeof(*eth), tlen;
+        uint16_t ether_type;
+
+        queues[i] = queue_id;
+        if (len < off)
+            continue;
+
+        ether_type = rte_be_to_cpu_16(eth->ether_type);
+        while ((ether_type == RTE_ETHER_TYPE_VLAN ||
+            ether_type == RTE_ETHER_TYPE_QINQ) &&
+            off + sizeof(struct rte_vlan_hdr) <= len) {
+            const struct rte_vlan_hdr *vh =
+                (const struct rte_vlan_hdr *)(pkt + off);
+            ether_type = rte_be_to_cpu_16(vh->eth_proto);
+            off += sizeof(*vh);
+        }
+
+        /* ARP and other non IP frames are handled here */
+        tlen = soft_rss_tuple(pkt + off, len - off, ether_type, tuple, 0);
+        if (tlen == 0)
+            continue;
+
+        queues[i] = rss_hash_queue(port_id, toeplitz_hash(tuple, tlen),
+            nb_queues);
+    }
 }
 
 int
@@ -2180,14 +3482,17 @@ ff_rss_check(void *softc, uint32_t saddr, uint32_t daddr,
         return 1;
     }
 
-    uint16_t reta_size = rss_reta_size[ctx->port_id];
     uint16_t queueid = qconf->tx_queue_id[ctx->port_id];
 
-    uint8_t data[sizeof(saddr) + sizeof(daddr) + sizeof(sport) +
-        sizeof(dport)];
+    uint8_t data[TOEPLITZ_TUPLE_LEN];
 
     unsigned datalen = 0;
 
+    /* rsskey is settled by init_port_start() */
+    if (unlikely(toeplitz_tbl_key != rsskey)) {
+        toeplitz_tbl_init(rsskey_len, rsskey);
+    }
+
     bcopy(&saddr, &data[datalen], sizeof(saddr));
     datalen += sizeof(saddr);
 
@@ -2200,10 +3505,9 @@ ff_rss_check(void *softc, uint32_t saddr, uint32_t daddr,
     bcopy(&dport, &data[datalen], sizeof(dport));
     datalen += sizeof(dport);
 
-    uint32_t hash = 0;
-    hash = toeplitz_hash(rsskey_len, rsskey, datalen, data);
+    uint32_t hash = toeplitz_hash(data, TOEPLITZ_TUPLE_LEN);
 
-    return ((hash & (reta_size - 1)) % nb_queues) == queueid;
+    return rss_hash_queue(ctx->port_id, hash, nb_queues) == queueid;
 }
 
 void
@@ -2212,6 +3516,12 @@ ff_regist_packet_dispatcher(dispatch_func_t func)
     packet_dispatcher = func;
 }
 
+void
+ff_regist_packet_burst_dispatcher(dispatch_burst_func_t func)
+{
+    packet_burst_dispatcher = func;
+}
+
 uint64_t
 ff_get_tsc_ns()
 {
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2017-2021 THL A29 Limited, a Tencent company.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_config.h>
+#include <rte_eal.h>
+#include <rte_errno.h>
+#include <rte_memzone.h>
+
+#include "ff_config.h"
+#include "ff_host_interface.h"
+#include "ff_dpdk_kmem.h"
+
+/*
+ * Hugepage arena for the stack's kernel memory.
+ *
+ * UMA slabs and other kmem_malloc() memory come from ff_mmap(), which
+ * otherwise maps anonymous 4K pages. Here they are carved out of memzones
+ * of the lcore's socket instead, reserved KMEM_CHUNK at a time until the
+ * configured cap. UMA asks for a few fixed slab sizes only, so freed
+ * blocks are kept on a free list per size in pages and handed out again
+ * as they are; the rare blocks above KMEM_MAX_PAGES go to one first fit
+ * list. The link lives in the free block itself.
+ *
+ * Every process has its own arena and only its lcore allocates, so there
+ * is no locking.
+ */
+
+#define KMEM_PAGE_SIZE  4096
+#define KMEM_CHUNK      (32UL << 20)
+#define KMEM_MAX_PAGES  64
+#define KMEM_MAX_CHUNKS 1024
+
+struct kmem_block {
+    struct kmem_block *next;
+    uint64_t npages;
+};
+
+static struct {
+    int socket_id;
+    uint64_t limit;
+    uint64_t reserved;
+    uint64_t in_use;
+    uint64_t peak;
+    uint64_t fallbacks;
+
+    /* bump allocation in the last chunk */
+    char *cur;
+    char *end;
+
+    unsigned nb_chunks;
+    struct {
+        char *start;
+        char *end;
+    } chunks[KMEM_MAX_CHUNKS];
+
+    struct kmem_block *free[KMEM_MAX_PAGES + 1];
+    struct kmem_block *large;
+} kmem;
+
+static void
+kmem_put(void *addr, uint64_t npages)
+{
+    struct kmem_block *b = addr;
+    struct kmem_block **head;
+
+    head = npages <= KMEM_MAX_PAGES ? &kmem.free[npages] : &kmem.large;
+    b->npages = npages;
+    b->next = *head;
+    *head = b;
+}
+
+static void *
+kmem_get(uint64_t npages)
+{
+    struct kmem_block *b, **pb;
+
+    if (npages <= KMEM_MAX_PAGES) {
+        b = kmem.free[npages];
+        if (b != NULL)
+            kmem.free[npages] = b->next;
+        return b;
+    }
+
+    for (pb = &kmem.large; (b = *pb) != NULL; pb = &b->next) {
+        if (b->npages < npages)
+            continue;
+
+        *pb = b->next;
+        if (b->npages > npages) {
+            kmem_put((char *)b + npages * KMEM_PAGE_SIZE,
+                b->npages - npages);
+        }
+        return b;
+    }
+
+    return NULL;
+}
+
+static int
+kmem_grow(void)
+{
+    const struct rte_memzone *mz;
+    char name[RTE_MEMZONE_NAMESIZE];
+
+    if (kmem.nb_chunks == KMEM_MAX_CHUNKS ||
+        kmem.reserved + KMEM_CHUNK > kmem.limit)
+        return -1;
+
+    snprintf(name, sizeof(name), "ff_kmem_%d_%u",
+        ff_global_cfg.dpdk.proc_id, kmem.nb_chunks);
+    /* zones outlive a process, a restarted one takes its own back */
+    mz = rte_memzone_lookup(name);
+    if (mz != NULL) {
+        if (mz->len < KMEM_CHUNK) {
+            printf("kmem: %s too small\n", name);
+            return -1;
+        }
+        /* the chunk is handed out as freshly zeroed memory */
+        memset(mz->addr, 0, KMEM_CHUNK);
+    } else {
+        mz = rte_memzone_reserve_aligned(name, KMEM_CHUNK, kmem.socket_id, 0,
+            KMEM_PAGE_SIZE);
+    }
+    if (mz == NULL) {
+        printf("kmem: reserve %s failed: %s\n", name,
+            rte_strerror(rte_errno));
+        return -1;
+    }
+
+    /* keep what is left of the previous chunk */
+    if (kmem.end - kmem.cur >= KMEM_PAGE_SIZE) {
+        kmem_put(kmem.cur, (kmem.end - kmem.cur) / KMEM_PAGE_SIZE);
+    }
+
+    kmem.cur = mz->addr;
+    kmem.end = kmem.cur + KMEM_CHUNK;
+    kmem.chunks[kmem.nb_chunks].start = kmem.cur;
+    kmem.chunks[kmem.nb_chunks].end = kmem.end;
+    kmem.nb_chunks++;
+    kmem.reserved += KMEM_CHUNK;
+
+    return 0;
+}
+
+int
+ff_kmem_init(int socket_id, uint64_t limit)
+{
+    kmem.socket_id = socket_id;
+    kmem.limit = RTE_ALIGN_FLOOR(limit, KMEM_CHUNK);
+    if (kmem.limit == 0)
+        return 0;
+
+    if (kmem_grow() < 0)
+        return -1;
+
+    printf("kmem: stack memory in hugepages of socket %d, up to %lu MB\n",
+        socket_id, kmem.limit >> 20);
+
+    return 0;
+}
+
+void *
+ff_kmem_alloc(uint64_t len)
+{
+    uint64_t npages = (len + KMEM_PAGE_SIZE - 1) / KMEM_PAGE_SIZE;
+    uint64_t size = npages * KMEM_PAGE_SIZE;
+    void *addr;
+
+    if (kmem.limit == 0 || size > KMEM_CHUNK)
+        return NULL;
+
+    addr = kmem_get(npages);
+    if (addr != NULL) {
+        /* as anonymous pages would be */
+        memset(addr, 0, size);
+    } else {
+        if ((uint64_t)(kmem.end - kmem.cur) < size && kmem_grow() < 0) {
+            kmem.fallbacks++;
+            return NULL;
+        }
+        /* fresh hugepage memory is zeroed */
+        addr = kmem.cur;
+        kmem.cur += size;
+    }
+
+    kmem.in_use += size;
+    if (kmem.in_use > kmem.peak)
+        kmem.peak = kmem.in_use;
+
+    return addr;
+}
+
+int
+ff_kmem_free(void *addr, uint64_t len)
+{
+    uint64_t npages = (len + KMEM_PAGE_SIZE - 1) / KMEM_PAGE_SIZE;
+    unsigned i;
+
+    if (kmem.nb_chunks == 0)
+        return -1;
+
+    for (i = 0; i < kmem.nb_chunks; i++) {
+        if ((char *)addr >= kmem.chunks[i].start &&
+            (char *)addr < kmem.chunks[i].end)
+            break;
+    }
+    if (i == kmem.nb_chunks)
+        return -1;
+
+    kmem_put(addr, npages);
+    kmem.in_use -= npages * KMEM_PAGE_SIZE;
+
+    return 0;
+}
+
+void
+ff_kmem_stats(uint64_t *limit, uint64_t *reserved, uint64_t *in_use,
+    uint64_t *peak, uint64_t *fallbacks)
+{
+    *limit = kmem.limit;
+    *reserved = kmem.reserved;
+    *in_use = kmem.in_use;
+    *peak = kmem.peak;
+    *fallbacks = kmem.fallbacks;
+}
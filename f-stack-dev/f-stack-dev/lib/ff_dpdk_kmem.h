@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017-2021 THL A29 Limited, a Tencent company.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _FSTACK_DPDK_KMEM_H
+#define _FSTACK_DPDK_KMEM_H
+
+/*
+ * Back the stack's kernel memory with hugepages of the lcore's socket,
+ * up to [freebsd.boot] hugemem_MB. Without it, or once the cap is reached,
+ * ff_mmap() falls back to anonymous host pages.
+ */
+int ff_kmem_init(int socket_id, uint64_t limit);
+
+/* NULL when not enabled, the cap is reached or len too large */
+void *ff_kmem_alloc(uint64_t len);
+
+/* Returns 0 if addr came from ff_kmem_alloc() and was freed */
+int ff_kmem_free(void *addr, uint64_t len);
+
+void ff_kmem_stats(uint64_t *limit, uint64_t *reserved, uint64_t *in_use,
+    uint64_t *peak, uint64_t *fallbacks);
+
+#endif /* ifndef _FSTACK_DPDK_KMEM_H */
@@ -569,3 +569,14 @@ ff_kni_enqueue(uint16_t port_id, struct rte_mbuf *pkt)
     return 0;
 }
 
+int
+ff_kni_enqueue_burst(uint16_t port_id, struct rte_mbuf **pkts, uint16_t count)
+{
+    unsigned nb_enq = rte_ring_enqueue_burst(kni_rp[port_id],
+        (void **)pkts, count, NULL);
+    if (nb_enq < count)
+        rte_pktmbuf_free_bulk(&pkts[nb_enq], count - nb_enq);
+
+    return nb_enq;
+}
+
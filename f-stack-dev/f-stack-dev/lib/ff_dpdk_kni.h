@@ -54,6 +54,7 @@ void ff_kni_process(uint16_t port_id, uint16_t queue_id,
 enum FilterReturn ff_kni_proto_filter(const void *data, uint16_t len, uint16_t eth_frame_type);
 
 int ff_kni_enqueue(uint16_t port_id, struct rte_mbuf *pkt);
+int ff_kni_enqueue_burst(uint16_t port_id, struct rte_mbuf **pkts, uint16_t count);
 
 
 #endif /* ifndef _FSTACK_DPDK_KNI_H */
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2017-2021 THL A29 Limited, a Tencent company.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <rte_common.h>
+#include <rte_config.h>
+#include <rte_eal.h>
+#include <rte_errno.h>
+#include <rte_memzone.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_spinlock.h>
+#include <rte_jhash.h>
+
+#include "ff_dpdk_if.h"
+#include "ff_config.h"
+#include "ff_veth.h"
+#include "ff_host_interface.h"
+#include "ff_memory.h"
+#include "ff_dpdk_neigh.h"
+
+/*
+ * Neighbor (ARP/ND) cache shared by all the processes.
+ *
+ * Every process owns its own lltable, so without this each one resolves
+ * every next hop by itself. The stack publishes the neighbors it confirms
+ * here, and a process that misses in its lltable takes the address from
+ * this cache instead of holding the packet and sending a request.
+ *
+ * The table lives in a memzone and is open addressed with a short probe
+ * window. Entries are overwritten in place and never freed, so a sequence
+ * count is enough for readers: they copy the entry and retry when a
+ * writer ran meanwhile. Writers serialize on a per entry spinlock.
+ */
+
+#define NEIGH_CACHE_MZ      "ff_neigh_cache"
+#define NEIGH_PROBE         8
+#define NEIGH_ADDR_LEN      16
+
+struct neigh_entry {
+    rte_spinlock_t lock;
+    volatile uint32_t seq;  /* odd while the entry is written */
+    uint16_t port_id;
+    uint8_t addr_len;       /* 0: free */
+    uint8_t addr[NEIGH_ADDR_LEN];
+    struct rte_ether_addr lladdr;
+    uint64_t updated;       /* tsc */
+} __rte_cache_aligned;
+
+struct neigh_cache {
+    uint32_t mask;
+    struct neigh_entry entries[];
+};
+
+static struct neigh_cache *neigh_cache;
+
+int
+ff_neigh_cache_init(unsigned nb_entries)
+{
+    const struct rte_memzone *mz;
+    uint32_t n;
+
+    if (rte_eal_process_type() != RTE_PROC_PRIMARY) {
+        mz = rte_memzone_lookup(NEIGH_CACHE_MZ);
+        if (mz == NULL) {
+            printf("neigh cache not created by the primary process\n");
+            return -1;
+        }
+        neigh_cache = mz->addr;
+        return 0;
+    }
+
+    n = rte_align32pow2(nb_entries < NEIGH_PROBE ? NEIGH_PROBE : nb_entries);
+    mz = rte_memzone_reserve(NEIGH_CACHE_MZ, sizeof(struct neigh_cache) +
+        n * sizeof(struct neigh_entry), rte_socket_id(), 0);
+    if (mz == NULL) {
+        printf("create neigh cache of %u entries failed: %s\n",
+            n, rte_strerror(rte_errno));
+        return -1;
+    }
+
+    memset(mz->addr, 0, mz->len);
+    neigh_cache = mz->addr;
+    neigh_cache->mask = n - 1;
+
+    printf("neigh cache created, %u entries\n", n);
+
+    return 0;
+}
+
+static inline int
+neigh_port(void *softc)
+{
+    struct ff_dpdk_if_context *ctx = ff_veth_softc_to_hostc(softc);
+    return ctx->port_id;
+}
+
+static inline uint32_t
+neigh_hash(uint16_t port_id, const void *addr, int addr_len)
+{
+    return rte_jhash(addr, addr_len, port_id);
+}
+
+static inline int
+neigh_match(const struct neigh_entry *e, uint16_t port_id,
+    const void *addr, int addr_len)
+{
+    return e->addr_len == addr_len && e->port_id == port_id &&
+        memcmp(e->addr, addr, addr_len) == 0;
+}
+
+int
+ff_neigh_lookup(void *softc, const void *addr, int addr_len,
+    void *lladdr, uint32_t *age)
+{
+    struct neigh_entry *e, copy;
+    uint32_t h, seq;
+    uint16_t port_id;
+    int i;
+
+    if (neigh_cache == NULL || addr_len > NEIGH_ADDR_LEN)
+        return -1;
+
+    port_id = neigh_port(softc);
+    h = neigh_hash(port_id, addr, addr_len);
+
+    for (i = 0; i < NEIGH_PROBE; i++) {
+        e = &neigh_cache->entries[(h + i) & neigh_cache->mask];
+        do {
+            seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) {
+                rte_pause();
+                continue;
+            }
+            copy.port_id = e->port_id;
+            copy.addr_len = e->addr_len;
+            memcpy(copy.addr, e->addr, NEIGH_ADDR_LEN);
+            copy.lladdr = e->lladdr;
+            copy.updated = e->updated;
+            rte_smp_rmb();
+        } while ((seq & 1) || seq != e->seq);
+
+        if (copy.addr_len == 0)
+            return -1;
+        if (!neigh_match(&copy, port_id, addr, addr_len))
+            continue;
+
+        rte_ether_addr_copy(&copy.lladdr, lladdr);
+        *age = (rte_get_tsc_cycles() - copy.updated) / rte_get_tsc_hz();
+        return 0;
+    }
+
+    return -1;
+}
+
+void
+ff_neigh_update(void *softc, const void *addr, int addr_len,
+    const void *lladdr)
+{
+    struct neigh_entry *e, *victim;
+    uint32_t h;
+    uint16_t port_id;
+    int i;
+
+    if (neigh_cache == NULL || addr_len > NEIGH_ADDR_LEN)
+        return;
+
+    port_id = neigh_port(softc);
+    h = neigh_hash(port_id, addr, addr_len);
+
+again:
+    /* the entry itself, else the first free or the oldest one */
+    victim = NULL;
+    for (i = 0; i < NEIGH_PROBE; i++) {
+        e = &neigh_cache->entries[(h + i) & neigh_cache->mask];
+        if (e->addr_len == 0 || neigh_match(e, port_id, addr, addr_len)) {
+            victim = e;
+            break;
+        }
+        if (victim == NULL || e->updated < victim->updated)
+            victim = e;
+    }
+
+    e = victim;
+    rte_spinlock_lock(&e->lock);
+    /* another process may have taken the slot meanwhile */
+    if (e->addr_len != 0 && !neigh_match(e, port_id, addr, addr_len) &&
+        i < NEIGH_PROBE) {
+        rte_spinlock_unlock(&e->lock);
+        goto again;
+    }
+
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+    rte_smp_wmb();
+    e->port_id = port_id;
+    e->addr_len = addr_len;
+    memset(e->addr, 0, NEIGH_ADDR_LEN);
+    memcpy(e->addr, addr, addr_len);
+    rte_ether_addr_copy(lladdr, &e->lladdr);
+    e->updated = rte_get_tsc_cycles();
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+
+    rte_spinlock_unlock(&e->lock);
+}
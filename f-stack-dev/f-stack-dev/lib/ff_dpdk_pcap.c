@@ -24,102 +24,371 @@
  *
  */
 
-#include <sys/time.h>
+/* rte_pcapng is still experimental in this dpdk */
+#define ALLOW_EXPERIMENTAL_API
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+
+#include <rte_config.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+#include <rte_errno.h>
+#include <rte_ring.h>
+#include <rte_mbuf.h>
+#include <rte_pcapng.h>
+#include <rte_bpf.h>
 
+#include "ff_config.h"
+#include "ff_msg.h"
 #include "ff_dpdk_pcap.h"
 #define FILE_PATH_LEN 64
 #define PCAP_FILE_NUM 10
 
-struct pcap_file_header {
-    uint32_t magic;
-    u_short version_major;
-    u_short version_minor;
-    int32_t thiszone;        /* gmt to local correction */
-    uint32_t sigfigs;        /* accuracy of timestamps */
-    uint32_t snaplen;        /* max length saved portion of each pkt */
-    uint32_t linktype;       /* data link type (LINKTYPE_*) */
-};
-
-struct pcap_pkthdr {
-    uint32_t sec;            /* time stamp */
-    uint32_t usec;           /* struct timeval time_t, in linux64: 8*2=16, in cap: 4 */
-    uint32_t caplen;         /* length of portion present */
-    uint32_t len;            /* length this packet (off wire) */
-};
-
-static __thread FILE* g_pcap_fp = NULL;
-static __thread uint32_t seq = 0;
-static __thread uint32_t g_flen = 0;
-
-int ff_enable_pcap(const char* dump_path, uint16_t snap_len)
+/*
+ * Capture is asynchronous: the lcore only copies the first snap_len bytes
+ * of each packet, with its tsc timestamp, into a pcapng block mbuf and
+ * enqueues it to a single producer single consumer ring. A control thread,
+ * off the dataplane cores, drains the ring into pcapng files and rotates
+ * them. Packets are dropped, and counted, when the ring or pool is full.
+ *
+ * [pcap] enable switches capture on at startup, FF_PCAP messages start and
+ * stop it at runtime with a direction, a packet limit and an eBPF filter
+ * run before anything is copied, ff_global_cfg.pcap.enable tells whether
+ * it is running.
+ */
+#define PCAP_RING_SIZE      4096
+#define PCAP_WRITE_BURST    64
+#define PCAP_WRITER_IDLE_US 1000
+
+static struct {
+    struct rte_ring *ring;
+    struct rte_mempool *pool;
+    rte_pcapng_t *pcapng;
+    pthread_t writer;
+    const char *dump_path;
+    unsigned lcore_id;
+    uint16_t snap_len;
+    uint32_t f_maxlen;
+    uint32_t seq;
+    uint64_t flen;
+    /* set by the lcore when a capture starts, to begin a new file */
+    int new_file;
+
+    int direction;
+    uint16_t max_snap_len;
+    uint64_t max_pkts;
+    struct rte_bpf *bpf;
+    struct rte_bpf_jit jit;
+
+    uint64_t captured;
+    uint64_t filtered;
+    uint64_t drops;
+} pcap;
+
+static int
+pcap_open(void)
 {
     char pcap_f_path[FILE_PATH_LEN] = {0};
+    int fd;
 
-    snprintf(pcap_f_path, FILE_PATH_LEN,  "%s/cpu%d_%d.pcap", dump_path==NULL?".":dump_path, rte_lcore_id(), seq);
-    g_pcap_fp = fopen(pcap_f_path, "w+");
-    if (g_pcap_fp == NULL) { 
-        rte_exit(EXIT_FAILURE, "Cannot open pcap dump path: %s, errno %d.\n", pcap_f_path, errno);
+    snprintf(pcap_f_path, FILE_PATH_LEN, "%s/cpu%d_%d.pcapng",
+        pcap.dump_path == NULL ? "." : pcap.dump_path, pcap.lcore_id, pcap.seq);
+    fd = open(pcap_f_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Cannot open pcap dump path: %s, errno %d.\n", pcap_f_path, errno);
         return -1;
     }
-    g_flen = 0;
 
-    struct pcap_file_header pcap_file_hdr;
-    void* file_hdr = &pcap_file_hdr;
+    pcap.pcapng = rte_pcapng_fdopen(fd, NULL, NULL, "f-stack", NULL);
+    if (pcap.pcapng == NULL) {
+        printf("Cannot write pcapng header to %s, errno %d.\n", pcap_f_path, rte_errno);
+        close(fd);
+        return -1;
+    }
+    pcap.flen = 0;
+
+    return 0;
+}
+
+static void *
+pcap_writer(__rte_unused void *arg)
+{
+    struct rte_mbuf *pkts[PCAP_WRITE_BURST];
+    unsigned n;
+    ssize_t len;
+
+    for (;;) {
+        if (__atomic_exchange_n(&pcap.new_file, 0, __ATOMIC_ACQUIRE) &&
+            pcap.pcapng != NULL) {
+            rte_pcapng_close(pcap.pcapng);
+            pcap.pcapng = NULL;
+            if (++pcap.seq >= PCAP_FILE_NUM)
+                pcap.seq = 0;
+            pcap_open();
+        }
+
+        n = rte_ring_sc_dequeue_burst(pcap.ring, (void **)pkts,
+            PCAP_WRITE_BURST, NULL);
+        if (n == 0) {
+            usleep(PCAP_WRITER_IDLE_US);
+            continue;
+        }
+
+        if (pcap.pcapng != NULL) {
+            len = rte_pcapng_write_packets(pcap.pcapng, pkts, n);
+            if (len > 0)
+                pcap.flen += len;
+        }
+        rte_pktmbuf_free_bulk(pkts, n);
+
+        if (pcap.pcapng == NULL || pcap.flen >= pcap.f_maxlen) {
+            if (pcap.pcapng != NULL) {
+                rte_pcapng_close(pcap.pcapng);
+                pcap.pcapng = NULL;
+                if (++pcap.seq >= PCAP_FILE_NUM)
+                    pcap.seq = 0;
+            }
+            if (pcap.drops) {
+                printf("pcap: %lu packets dropped\n", pcap.drops);
+            }
+            pcap_open();
+        }
+    }
+
+    return NULL;
+}
 
-    pcap_file_hdr.magic = 0xA1B2C3D4;
-    pcap_file_hdr.version_major = 0x0002;
-    pcap_file_hdr.version_minor = 0x0004;
-    pcap_file_hdr.thiszone = 0x00000000;
-    pcap_file_hdr.sigfigs = 0x00000000;
-    pcap_file_hdr.snaplen = snap_len;   //0x0000FFFF;  //65535
-    pcap_file_hdr.linktype = 0x00000001; //DLT_EN10MB, Ethernet (10Mb)
+/*
+ * Pool and ring of a restarted process are still there, take them over;
+ * returns 0 or an errno, the lcore may be running.
+ */
+static int
+pcap_setup(const char* dump_path, uint16_t snap_len, uint32_t f_maxlen)
+{
+    char name[RTE_RING_NAMESIZE];
+    unsigned lcore_id = rte_lcore_id();
+    struct rte_mempool *pool;
+    struct rte_ring *ring;
+    struct rte_mbuf *m;
+    int ret;
 
-    fwrite(file_hdr, sizeof(struct pcap_file_header), 1, g_pcap_fp);
-    g_flen += sizeof(struct pcap_file_header);
+    /* once per process, whatever the number of ports */
+    if (pcap.ring != NULL) {
+        return 0;
+    }
+
+    snprintf(name, sizeof(name), "pcap_pool_%u", lcore_id);
+    pool = rte_mempool_lookup(name);
+    if (pool == NULL) {
+        pool = rte_pktmbuf_pool_create(name, PCAP_RING_SIZE * 2 - 1, 0, 0,
+            rte_pcapng_mbuf_size(snap_len), rte_socket_id());
+    } else if (rte_pktmbuf_data_room_size(pool) < rte_pcapng_mbuf_size(snap_len)) {
+        printf("pcap pool %s too small for snaplen %u\n", name, snap_len);
+        return ENOSPC;
+    }
+    if (pool == NULL) {
+        printf("Cannot create pcap pool: %s\n", rte_strerror(rte_errno));
+        return rte_errno;
+    }
+
+    snprintf(name, sizeof(name), "pcap_ring_%u", lcore_id);
+    ring = rte_ring_lookup(name);
+    if (ring == NULL) {
+        ring = rte_ring_create(name, PCAP_RING_SIZE, rte_socket_id(),
+            RING_F_SP_ENQ | RING_F_SC_DEQ);
+    }
+    if (ring == NULL) {
+        printf("Cannot create pcap ring: %s\n", rte_strerror(rte_errno));
+        return rte_errno;
+    }
+    /* left over by a previous process, its writer is gone */
+    while (rte_ring_sc_dequeue(ring, (void **)&m) == 0) {
+        rte_pktmbuf_free(m);
+    }
+
+    pcap.dump_path = dump_path;
+    pcap.lcore_id = lcore_id;
+    pcap.snap_len = snap_len;
+    pcap.max_snap_len = snap_len;
+    pcap.f_maxlen = f_maxlen;
+    pcap.direction = FF_PCAP_DIR_IN | FF_PCAP_DIR_OUT;
+    pcap.pool = pool;
+
+    if (pcap_open() < 0) {
+        printf("Cannot open pcap file in %s\n", dump_path);
+        return EIO;
+    }
+
+    pcap.ring = ring;
+    snprintf(name, sizeof(name), "ff_pcap_%u", lcore_id);
+    ret = rte_ctrl_thread_create(&pcap.writer, name, NULL, pcap_writer, NULL);
+    if (ret != 0) {
+        printf("Cannot create pcap writer thread\n");
+        pcap.ring = NULL;
+        rte_pcapng_close(pcap.pcapng);
+        pcap.pcapng = NULL;
+        return ret;
+    }
 
     return 0;
 }
 
 int
-ff_dump_packets(const char* dump_path, struct rte_mbuf* pkt, uint16_t snap_len, uint32_t f_maxlen)
+ff_enable_pcap(const char* dump_path, uint16_t snap_len, uint32_t f_maxlen)
 {
-    unsigned int out_len = 0, wr_len = 0;
-    struct pcap_pkthdr pcap_hdr;
-    void* hdr = &pcap_hdr;
-    struct timeval ts;
-    char pcap_f_path[FILE_PATH_LEN] = {0};
+    if (pcap_setup(dump_path, snap_len, f_maxlen) != 0) {
+        rte_exit(EXIT_FAILURE, "Cannot enable pcap in %s\n", dump_path);
+    }
 
-    if (g_pcap_fp == NULL) {
-        return -1;
+    return 0;
+}
+
+static void
+pcap_filter_free(void)
+{
+    if (pcap.bpf != NULL) {
+        rte_bpf_destroy(pcap.bpf);
+        pcap.bpf = NULL;
+        pcap.jit.func = NULL;
     }
-    snap_len = pkt->pkt_len < snap_len ? pkt->pkt_len : snap_len;
-    gettimeofday(&ts, NULL);
-    pcap_hdr.sec = ts.tv_sec;
-    pcap_hdr.usec = ts.tv_usec;
-    pcap_hdr.caplen = snap_len;
-    pcap_hdr.len = pkt->pkt_len;
-    fwrite(hdr, sizeof(struct pcap_pkthdr), 1, g_pcap_fp);
-    g_flen += sizeof(struct pcap_pkthdr);
+}
 
-    while(pkt != NULL && out_len <= snap_len) {
-        wr_len = snap_len - out_len;
-        wr_len = wr_len > pkt->data_len ? pkt->data_len : wr_len ;
-        fwrite(rte_pktmbuf_mtod(pkt, char*), wr_len, 1, g_pcap_fp);
-        out_len += wr_len;
-        pkt = pkt->next;
+int
+ff_pcap_start(struct ff_pcap_args *args)
+{
+    uint16_t snap_len = args->snap_len ? args->snap_len :
+        ff_global_cfg.pcap.snap_len;
+    struct rte_bpf *bpf = NULL;
+    struct rte_bpf_jit jit = { .func = NULL };
+
+    if ((args->direction & (FF_PCAP_DIR_IN | FF_PCAP_DIR_OUT)) == 0) {
+        return EINVAL;
+    }
+
+    /* a running capture keeps its filter until the new one is loaded */
+    if (args->filter != NULL && args->filter_len > 0) {
+        struct rte_bpf_prm prm = {
+            .ins = args->filter,
+            .nb_ins = args->filter_len,
+            .prog_arg = {
+                .type = RTE_BPF_ARG_PTR_MBUF,
+                .size = sizeof(struct rte_mbuf),
+                .buf_size = RTE_MBUF_DEFAULT_BUF_SIZE,
+            },
+        };
+
+        bpf = rte_bpf_load(&prm);
+        if (bpf == NULL) {
+            return rte_errno;
+        }
+        /* falls back to the interpreter without jit */
+        rte_bpf_get_jit(bpf, &jit);
     }
-    g_flen += out_len;
 
-    if ( g_flen >= f_maxlen ){
-        fclose(g_pcap_fp);
-        if ( ++seq >= PCAP_FILE_NUM )
-            seq = 0;
-        
-        ff_enable_pcap(dump_path, snap_len);
+    if (pcap.ring == NULL) {
+        int ret = pcap_setup(ff_global_cfg.pcap.save_path,
+            RTE_MAX(snap_len, ff_global_cfg.pcap.snap_len),
+            ff_global_cfg.pcap.save_len);
+        if (ret != 0) {
+            if (bpf != NULL) {
+                rte_bpf_destroy(bpf);
+            }
+            return ret;
+        }
+    } else {
+        __atomic_store_n(&pcap.new_file, 1, __ATOMIC_RELEASE);
     }
 
+    pcap_filter_free();
+    pcap.bpf = bpf;
+    pcap.jit = jit;
+
+    /* the pool's mbufs hold max_snap_len bytes */
+    pcap.snap_len = RTE_MIN(snap_len, pcap.max_snap_len);
+    pcap.direction = args->direction;
+    pcap.max_pkts = args->max_pkts;
+    pcap.captured = pcap.filtered = pcap.drops = 0;
+    ff_global_cfg.pcap.enable = 1;
+
+    printf("pcap started, direction %d, snaplen %u, filter %u insns\n",
+        pcap.direction, pcap.snap_len, pcap.bpf ? args->filter_len : 0);
+
     return 0;
 }
 
+void
+ff_pcap_stop(void)
+{
+    ff_global_cfg.pcap.enable = 0;
+    pcap_filter_free();
+}
+
+void
+ff_pcap_status(struct ff_pcap_args *args)
+{
+    args->running = ff_global_cfg.pcap.enable;
+    args->direction = pcap.direction;
+    args->snap_len = pcap.snap_len;
+    args->max_pkts = pcap.max_pkts;
+    args->captured = pcap.captured;
+    args->filtered = pcap.filtered;
+    args->drops = pcap.drops;
+}
+
+void
+ff_dump_packets(uint16_t port_id, uint16_t queue_id, struct rte_mbuf **pkts,
+    uint16_t nb_pkts, int tx)
+{
+    struct rte_mbuf *copies[nb_pkts];
+    uint64_t rc[nb_pkts];
+    uint64_t tsc, left;
+    uint16_t i, n = 0;
+    unsigned nb_enq;
+
+    if (!(pcap.direction & (tx ? FF_PCAP_DIR_OUT : FF_PCAP_DIR_IN))) {
+        return;
+    }
+
+    if (pcap.bpf != NULL) {
+        if (pcap.jit.func != NULL) {
+            for (i = 0; i < nb_pkts; i++)
+                rc[i] = pcap.jit.func(pkts[i]);
+        } else {
+            rte_bpf_exec_burst(pcap.bpf, (void **)pkts, rc, nb_pkts);
+        }
+    }
+
+    left = pcap.max_pkts ? pcap.max_pkts - pcap.captured : UINT64_MAX;
+    tsc = rte_get_tsc_cycles();
+    for (i = 0; i < nb_pkts && n < left; i++) {
+        if (pcap.bpf != NULL && rc[i] == 0) {
+            pcap.filtered++;
+            continue;
+        }
+
+        copies[n] = rte_pcapng_copy(port_id, queue_id, pkts[i], pcap.pool,
+            pcap.snap_len, tsc, tx ? RTE_PCAPNG_DIRECTION_OUT :
+            RTE_PCAPNG_DIRECTION_IN);
+        if (copies[n] != NULL)
+            n++;
+        else
+            pcap.drops++;
+    }
+
+    nb_enq = rte_ring_sp_enqueue_burst(pcap.ring, (void **)copies, n, NULL);
+    if (unlikely(nb_enq < n)) {
+        rte_pktmbuf_free_bulk(&copies[nb_enq], n - nb_enq);
+        pcap.drops += n - nb_enq;
+    }
+    pcap.captured += nb_enq;
+
+    if (pcap.max_pkts && pcap.captured >= pcap.max_pkts) {
+        printf("pcap stopped after %lu packets\n", pcap.captured);
+        ff_pcap_stop();
+    }
+}
@@ -30,8 +30,16 @@
 #include <rte_config.h>
 #include <rte_mbuf.h>
 
-int ff_enable_pcap(const char* dump_path, uint16_t snap_len);
-int ff_dump_packets(const char* dump_path, struct rte_mbuf *pkt, uint16_t snap_len, uint32_t f_maxlen);
+int ff_enable_pcap(const char* dump_path, uint16_t snap_len, uint32_t f_maxlen);
+struct ff_pcap_args;
+/* Runtime control through FF_PCAP messages */
+int ff_pcap_start(struct ff_pcap_args *args);
+void ff_pcap_stop(void);
+void ff_pcap_status(struct ff_pcap_args *args);
+
+/* Queue a burst to the pcap writer, `tx` tells its direction */
+void ff_dump_packets(uint16_t port_id, uint16_t queue_id, struct rte_mbuf **pkts,
+    uint16_t nb_pkts, int tx);
 
 
 #endif /* ifndef _FSTACK_DPDK_PCAP_H */
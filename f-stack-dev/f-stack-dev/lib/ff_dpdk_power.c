@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2017-2021 THL A29 Limited, a Tencent company.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* rte_power_monitor() and friends are still experimental in this dpdk */
+#define ALLOW_EXPERIMENTAL_API
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rte_common.h>
+#include <rte_config.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+#include <rte_cpuflags.h>
+#include <rte_power_intrinsics.h>
+#include <rte_epoll.h>
+#include <rte_ethdev.h>
+
+#include "ff_dpdk_if.h"
+#include "ff_config.h"
+#include "ff_memory.h"
+#include "ff_dpdk_power.h"
+
+/*
+ * Idle waiting of the main loop.
+ *
+ * After power_empty_polls iterations without packets the loop waits
+ * instead of polling again, how depends on the least saving power_mode
+ * of the process's ports:
+ * - backoff sleeps, the sleep doubling up to power_max_wait while idle;
+ * - monitor arms UMWAIT on the next rx descriptor of every queue, so the
+ *   NIC writing a packet ends the wait, and falls back to TPAUSE, or to
+ *   backoff, without CPU or PMD support;
+ * - interrupt also sleeps in epoll on the rx interrupts once idle for
+ *   power_intr_delay.
+ * No wait lasts longer than power_max_wait, which bounds how long packets
+ * of the dispatch rings and ipc messages wait, nor past the deadline the
+ * loop passes, the next stack clock tick or an ff_epoll_wait() timeout,
+ * and a packet found ends the idle period at once.
+ */
+
+extern struct lcore_conf lcore_conf;
+
+static struct {
+    int mode;
+    int monitor;
+    int pause;
+    int intr;
+
+    unsigned empty_polls;
+    unsigned max_empty_polls;
+    uint64_t idle_tsc;          /* start of the idle period */
+    uint64_t wait_tsc;          /* next backoff sleep */
+    uint64_t max_wait_tsc;
+    uint64_t intr_delay_tsc;
+    uint64_t us_tsc;
+
+    struct rte_power_monitor_cond pmc[MAX_RX_QUEUE_PER_LCORE];
+} power;
+
+int
+ff_power_enabled(void)
+{
+    return power.mode != FF_POWER_BUSY;
+}
+
+static int
+power_monitor_init(void)
+{
+    struct lcore_conf *qconf = &lcore_conf;
+    struct rte_cpu_intrinsics intrinsics;
+    struct rte_power_monitor_cond pmc;
+    uint16_t i;
+
+    rte_cpu_get_intrinsics_support(&intrinsics);
+    power.pause = intrinsics.power_pause;
+
+    if (!(qconf->nb_rx_queue == 1 ? intrinsics.power_monitor :
+        intrinsics.power_monitor_multi)) {
+        printf("power: cpu can't monitor %u rx queues\n", qconf->nb_rx_queue);
+        return 0;
+    }
+
+    for (i = 0; i < qconf->nb_rx_queue; i++) {
+        if (rte_eth_get_monitor_addr(qconf->rx_queue_list[i].port_id,
+            qconf->rx_queue_list[i].queue_id, &pmc) != 0) {
+            printf("power: port%u can't be monitored\n",
+                qconf->rx_queue_list[i].port_id);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int
+power_intr_init(void)
+{
+    struct lcore_conf *qconf = &lcore_conf;
+    uint16_t i, port_id, queue_id;
+    int ret;
+
+    for (i = 0; i < qconf->nb_rx_queue; i++) {
+        port_id = qconf->rx_queue_list[i].port_id;
+        queue_id = qconf->rx_queue_list[i].queue_id;
+
+        ret = rte_eth_dev_rx_intr_ctl_q(port_id, queue_id,
+            RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL);
+        if (ret != 0) {
+            printf("power: no rx interrupts on port%u queue%u: %s\n",
+                port_id, queue_id, strerror(-ret));
+            while (i-- > 0) {
+                rte_eth_dev_rx_intr_ctl_q(qconf->rx_queue_list[i].port_id,
+                    qconf->rx_queue_list[i].queue_id,
+                    RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_DEL, NULL);
+            }
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int
+ff_power_init(void)
+{
+    struct lcore_conf *qconf = &lcore_conf;
+    int mode = FF_POWER_INTERRUPT;
+    uint16_t i;
+
+    for (i = 0; i < qconf->nb_rx_queue; i++) {
+        mode = RTE_MIN(mode,
+            qconf->port_cfgs[qconf->rx_queue_list[i].port_id].power_mode);
+    }
+
+    if (qconf->nb_rx_queue == 0 || mode == FF_POWER_BUSY) {
+        power.mode = FF_POWER_BUSY;
+        return 0;
+    }
+
+    power.mode = mode;
+    power.us_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S;
+    power.max_empty_polls = ff_global_cfg.dpdk.power_empty_polls;
+    power.max_wait_tsc = power.us_tsc * ff_global_cfg.dpdk.power_max_wait;
+    power.intr_delay_tsc = power.us_tsc * ff_global_cfg.dpdk.power_intr_delay;
+
+    if (mode >= FF_POWER_MONITOR) {
+        power.monitor = power_monitor_init();
+    }
+
+    if (mode == FF_POWER_INTERRUPT) {
+        power.intr = power_intr_init();
+    }
+
+    printf("power: lcore %u waits when idle with%s%s%s sleep\n",
+        rte_lcore_id(), power.intr ? " rx interrupts," : "",
+        power.monitor ? " monitor," : "", power.pause ? " pause," : "");
+
+    return 0;
+}
+
+static void
+power_wait_monitor(uint64_t until_tsc)
+{
+    struct lcore_conf *qconf = &lcore_conf;
+    uint16_t i;
+
+    /* the next descriptor moves with every packet received */
+    for (i = 0; i < qconf->nb_rx_queue; i++) {
+        if (rte_eth_get_monitor_addr(qconf->rx_queue_list[i].port_id,
+            qconf->rx_queue_list[i].queue_id, &power.pmc[i]) != 0) {
+            return;
+        }
+    }
+
+    if (qconf->nb_rx_queue == 1) {
+        rte_power_monitor(&power.pmc[0], until_tsc);
+    } else {
+        rte_power_monitor_multi(power.pmc, qconf->nb_rx_queue, until_tsc);
+    }
+}
+
+static void
+power_wait_intr(uint64_t cur_tsc, uint64_t until_tsc)
+{
+    struct lcore_conf *qconf = &lcore_conf;
+    struct rte_epoll_event events[MAX_RX_QUEUE_PER_LCORE];
+    uint64_t ms_tsc = power.us_tsc * 1000;
+    uint16_t i;
+
+    int pending = 0;
+    uint16_t port_id, queue_id;
+
+    for (i = 0; i < qconf->nb_rx_queue; i++) {
+        port_id = qconf->rx_queue_list[i].port_id;
+        queue_id = qconf->rx_queue_list[i].queue_id;
+        rte_eth_dev_rx_intr_enable(port_id, queue_id);
+        /* received before the interrupt was armed */
+        if (rte_eth_rx_queue_count(port_id, queue_id) > 0)
+            pending = 1;
+    }
+
+    if (!pending) {
+        rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, qconf->nb_rx_queue,
+            (until_tsc - cur_tsc + ms_tsc - 1) / ms_tsc);
+    }
+
+    for (i = 0; i < qconf->nb_rx_queue; i++) {
+        rte_eth_dev_rx_intr_disable(qconf->rx_queue_list[i].port_id,
+            qconf->rx_queue_list[i].queue_id);
+    }
+}
+
+uint64_t
+ff_power_idle(int idle, uint64_t cur_tsc, uint64_t deadline_tsc)
+{
+    uint64_t until_tsc;
+
+    if (!idle) {
+        power.empty_polls = 0;
+        return cur_tsc;
+    }
+
+    if (power.empty_polls++ == 0) {
+        power.idle_tsc = cur_tsc;
+        power.wait_tsc = power.us_tsc;
+    }
+
+    if (power.empty_polls < power.max_empty_polls || deadline_tsc <= cur_tsc)
+        return cur_tsc;
+
+    /*
+     * these wake up on a packet only, not on the dispatch rings or ipc
+     * messages, which thus wait at most power_max_wait as well
+     */
+    until_tsc = RTE_MIN(deadline_tsc, cur_tsc + power.max_wait_tsc);
+    if (power.intr && cur_tsc - power.idle_tsc >= power.intr_delay_tsc) {
+        power_wait_intr(cur_tsc, until_tsc);
+        return rte_rdtsc();
+    }
+
+    if (power.monitor) {
+        power_wait_monitor(until_tsc);
+        return rte_rdtsc();
+    }
+
+    if (power.mode >= FF_POWER_MONITOR && power.pause) {
+        rte_power_pause(until_tsc);
+        return rte_rdtsc();
+    }
+
+    until_tsc = RTE_MIN(until_tsc, cur_tsc + power.wait_tsc);
+    usleep((until_tsc - cur_tsc) / power.us_tsc);
+    power.wait_tsc = RTE_MIN(power.wait_tsc * 2, power.max_wait_tsc);
+
+    return rte_rdtsc();
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2017-2021 THL A29 Limited, a Tencent company.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <rte_common.h>
+#include <rte_config.h>
+#include <rte_eal.h>
+#include <rte_errno.h>
+#include <rte_memzone.h>
+#include <rte_cycles.h>
+#include <rte_telemetry.h>
+
+#include "ff_dpdk_stats.h"
+
+static const char *drop_names[FF_DROP_NUM] = {
+    [FF_DROP_RX_CSUM] = "drop_rx_csum",
+    [FF_DROP_RX_NOMEM] = "drop_rx_nomem",
+    [FF_DROP_DISPATCH] = "drop_dispatch",
+    [FF_DROP_RING_FULL] = "drop_ring_full",
+    [FF_DROP_TX_FULL] = "drop_tx_full",
+    [FF_DROP_TX_NOMEM] = "drop_tx_nomem",
+    [FF_DROP_CLONE_NOMEM] = "drop_clone_nomem",
+};
+
+static struct ff_stats *ff_stats;
+
+static int
+stats_procs_cb(const char *cmd __rte_unused, const char *params __rte_unused,
+    struct rte_tel_data *d)
+{
+    uint32_t i;
+
+    rte_tel_data_start_array(d, RTE_TEL_INT_VAL);
+    for (i = 0; i < ff_stats->nb_procs; i++) {
+        if (ff_stats->procs[i].active)
+            rte_tel_data_add_array_int(d, i);
+    }
+
+    return 0;
+}
+
+#define ADD_U64(name, val) rte_tel_data_add_dict_u64(d, name, val)
+
+static int
+stats_proc_cb(const char *cmd __rte_unused, const char *params,
+    struct rte_tel_data *d)
+{
+    const struct ff_lcore_stats *s;
+    char name[RTE_TEL_MAX_STRING_LEN];
+    char *end;
+    unsigned long proc_id;
+    int i;
+
+    if (params == NULL || *params == '\0')
+        return -1;
+
+    proc_id = strtoul(params, &end, 0);
+    if (*end != '\0' || proc_id >= ff_stats->nb_procs)
+        return -1;
+
+    s = &ff_stats->procs[proc_id];
+
+    rte_tel_data_start_dict(d);
+    ADD_U64("active", s->active);
+    ADD_U64("lcore_id", s->lcore_id);
+    ADD_U64("tsc_hz", ff_stats->tsc_hz);
+    ADD_U64("sample_tsc", s->sample_tsc);
+    ADD_U64("loops", s->top.loops);
+    ADD_U64("idle_tsc", s->top.idle_tsc);
+    ADD_U64("work_tsc", s->top.work_tsc);
+    ADD_U64("sys_tsc", s->top.sys_tsc);
+    ADD_U64("usr_tsc", s->top.usr_tsc);
+    ADD_U64("rx_bursts", s->rx_bursts);
+    ADD_U64("rx_empty_polls", s->rx_empty_polls);
+    ADD_U64("rx_packets", s->traffic.rx_packets);
+    ADD_U64("rx_bytes", s->traffic.rx_bytes);
+    ADD_U64("tx_bursts", s->tx_bursts);
+    ADD_U64("tx_packets", s->traffic.tx_packets);
+    ADD_U64("tx_bytes", s->traffic.tx_bytes);
+    for (i = 0; i < FF_DROP_NUM; i++)
+        ADD_U64(drop_names[i], s->drops[i]);
+    ADD_U64("msgs", s->msgs);
+    ADD_U64("msg_wait_tsc", s->msg_wait_tsc);
+    ADD_U64("msg_handle_tsc", s->msg_handle_tsc);
+    ADD_U64("dispatch_ring_count", s->dispatch_ring_count);
+    ADD_U64("mbuf_avail", s->mbuf_avail);
+    ADD_U64("mbuf_in_use", s->mbuf_in_use);
+    ADD_U64("mbuf_pressure", s->mbuf_pressure);
+    ADD_U64("mbuf_pressure_events", s->mbuf_pressure_events);
+    for (i = 0; i < (int)s->nb_pools && i <= FF_MAX_MBUF_POOLS; i++) {
+        snprintf(name, sizeof(name), "mbuf_pool_%lu_avail",
+            s->pools[i].data_size);
+        ADD_U64(name, s->pools[i].avail);
+        snprintf(name, sizeof(name), "mbuf_pool_%lu_in_use",
+            s->pools[i].data_size);
+        ADD_U64(name, s->pools[i].in_use);
+        snprintf(name, sizeof(name), "mbuf_pool_%lu_common",
+            s->pools[i].data_size);
+        ADD_U64(name, s->pools[i].common);
+        snprintf(name, sizeof(name), "mbuf_pool_%lu_cache",
+            s->pools[i].data_size);
+        ADD_U64(name, s->pools[i].cache);
+    }
+
+    return 0;
+}
+
+struct ff_lcore_stats *
+ff_stats_init(uint16_t proc_id, uint16_t nb_procs)
+{
+    const struct rte_memzone *mz;
+
+    if (rte_eal_process_type() != RTE_PROC_PRIMARY) {
+        mz = rte_memzone_lookup(FF_STATS_MZ);
+        if (mz == NULL) {
+            printf("stats not created by the primary process\n");
+            return NULL;
+        }
+        ff_stats = mz->addr;
+        /* counters start over when a process restarts */
+        memset(&ff_stats->procs[proc_id], 0, sizeof(struct ff_lcore_stats));
+        return &ff_stats->procs[proc_id];
+    }
+
+    mz = rte_memzone_reserve(FF_STATS_MZ, sizeof(struct ff_stats),
+        rte_socket_id(), 0);
+    if (mz == NULL) {
+        printf("create stats memzone failed: %s\n", rte_strerror(rte_errno));
+        return NULL;
+    }
+
+    memset(mz->addr, 0, mz->len);
+    ff_stats = mz->addr;
+    ff_stats->tsc_hz = rte_get_tsc_hz();
+    ff_stats->nb_procs = nb_procs;
+
+    /* only the primary owns the telemetry socket */
+    rte_telemetry_register_cmd("/fstack/procs", stats_procs_cb,
+        "Returns the ids of the running f-stack processes.");
+    rte_telemetry_register_cmd("/fstack/stats", stats_proc_cb,
+        "Returns the counters of an f-stack process. Parameters: int proc_id");
+
+    return &ff_stats->procs[proc_id];
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2017-2021 THL A29 Limited, a Tencent company.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _FSTACK_DPDK_STATS_H
+#define _FSTACK_DPDK_STATS_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_memory.h>
+
+#include "ff_config.h"
+#include "ff_msg.h"
+
+/*
+ * Per process counters, published in a memzone that any secondary
+ * process can look up and read while the processes run. Every counter
+ * has a single writer, the process that owns the slot, and is updated
+ * with one aligned 64 bit store, so readers need no locking; they only
+ * see the counters at slightly different instants.
+ */
+
+#define FF_STATS_MZ "ff_lcore_stats"
+
+/* Gauges are sampled this often */
+#define FF_STATS_SAMPLE_MS  100
+
+enum FF_DROP_REASON {
+    FF_DROP_RX_CSUM = 0,    /* bad checksum reported by the NIC */
+    FF_DROP_RX_NOMEM,       /* no stack mbuf for a received packet */
+    FF_DROP_DISPATCH,       /* packet dispatcher returned a drop */
+    FF_DROP_RING_FULL,      /* dispatch ring of the target queue full */
+    FF_DROP_TX_FULL,        /* tx queue full */
+    FF_DROP_TX_NOMEM,       /* no dpdk mbuf for a sent packet */
+    FF_DROP_CLONE_NOMEM,    /* no mbuf to copy an ARP/NDP frame out */
+    FF_DROP_NUM,
+};
+
+struct ff_lcore_stats {
+    /* set once the owning process runs its main loop */
+    uint32_t active;
+    uint32_t lcore_id;
+
+    /* tsc of the last gauge sample */
+    uint64_t sample_tsc;
+
+    /* main loop time: stack (sys), user (usr) and idle */
+    struct ff_top_args top;
+
+    uint64_t rx_bursts;
+    uint64_t rx_empty_polls;
+    uint64_t tx_bursts;
+    uint64_t drops[FF_DROP_NUM];
+
+    /* ipc messages handled, time queued and time spent on them */
+    uint64_t msgs;
+    uint64_t msg_wait_tsc;
+    uint64_t msg_handle_tsc;
+
+    /* gauges */
+    uint64_t dispatch_ring_count;   /* packets queued for this process */
+    uint64_t mbuf_avail;            /* free mbufs of the socket's pool */
+    uint64_t mbuf_in_use;
+
+    /* set while the stack is told to save mbufs, and times it was */
+    uint64_t mbuf_pressure;
+    uint64_t mbuf_pressure_events;
+
+    /*
+     * all the mbuf pools of the socket, default one included; avail
+     * counts the mbufs cached by every lcore, common and cache only the
+     * ones this process can take: the common pool and its lcore's cache.
+     */
+    uint32_t nb_pools;
+    uint32_t reserved;
+    struct {
+        uint64_t data_size;
+        uint64_t avail;
+        uint64_t in_use;
+        uint64_t common;
+        uint64_t cache;
+    } pools[FF_MAX_MBUF_POOLS + 1];
+
+    struct ff_traffic_args traffic;
+} __rte_cache_aligned;
+
+struct ff_stats {
+    uint64_t tsc_hz;
+    uint32_t nb_procs;
+    struct ff_lcore_stats procs[RTE_MAX_LCORE];
+};
+
+/*
+ * Create (primary) or attach to (secondary) the stats memzone and return
+ * the slot of proc_id. The primary also registers the /fstack telemetry
+ * commands that read every process's slot.
+ */
+struct ff_lcore_stats *ff_stats_init(uint16_t proc_id, uint16_t nb_procs);
+
+#endif /* ifndef _FSTACK_DPDK_STATS_H */
@@ -19,25 +19,99 @@
 
 #include "ff_api.h"
 #include "ff_errno.h"
+#include "ff_host_interface.h"
 
 
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+/*
+ * An fd is registered as one kevent per direction it's interested in,
+ * both carry the epoll mask in ext[2] (passed through by kqueue), so that
+ * ff_epoll_wait() reports one merged epoll_event per fd with only the
+ * requested events.
+ */
+#define EPOLL_KEV_MASK      2
+/* and ext[3] what kqueue has to do beyond a plain kevent change */
+#define EPOLL_KEV_OP        3
+#define EPOLL_READ_EVENTS   (EPOLLIN | EPOLLPRI | EPOLLRDHUP)
+
+/* EVFILT_READ is also kept without EPOLLIN to report EPOLLHUP/EPOLLERR */
+#define EPOLL_WANT_READ(m)  (((m) & EPOLL_READ_EVENTS) || !((m) & EPOLLOUT))
+#define EPOLL_WANT_WRITE(m) ((m) & EPOLLOUT)
+
+struct epoll_slot {
+    uintptr_t ident;
+    uint32_t gen;
+    int idx;
+};
+
+/*
+ * State of the ff_epoll_wait() in progress, the fd -> epoll_event table
+ * used for merging is sized to twice maxevents and never gets full.
+ */
+static struct {
+    struct epoll_event *events;
+    int nevents;
+    struct epoll_slot *slots;
+    uint32_t slot_mask;
+    uint32_t gen;
+    struct kevent *disables;
+    int ndisables;
+    int cap;
+} epoll_merge;
+
 int
 ff_epoll_create(int size __attribute__((__unused__)))
 {
     return ff_kqueue();
 }
 
+/*
+ * Delete the given directions of the fd, or with `probe` only check them.
+ * Return 1 if anything of the fd was registered, 0 if nothing.
+ */
+static int
+epoll_kev_check(int epfd, int fd, int rd, int wr, int probe)
+{
+    struct kevent kev[2], res[2];
+    int i, n, found = 0, changes = 0;
+    int flags = probe ? EV_RECEIPT : EV_DELETE | EV_RECEIPT;
+
+    if (rd) {
+        EV_SET(&kev[changes], fd, EVFILT_READ, flags, 0, 0, NULL);
+        kev[changes++].ext[EPOLL_KEV_OP] = probe ? ff_KEV_EPOLL_PROBE : 0;
+    }
+    if (wr) {
+        EV_SET(&kev[changes], fd, EVFILT_WRITE, flags, 0, 0, NULL);
+        kev[changes++].ext[EPOLL_KEV_OP] = probe ? ff_KEV_EPOLL_PROBE : 0;
+    }
+    if (changes == 0)
+        return 0;
+
+    n = ff_kevent(epfd, kev, changes, res, changes, NULL);
+    if (n < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (res[i].data == 0) {
+            found = 1;
+        } else if (res[i].data != ENOENT) {
+            errno = res[i].data;
+            return -1;
+        }
+    }
+
+    return found;
+}
+
 int
 ff_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
 {
-    /*
-     * Since kqueue uses EVFILT_READ and EVFILT_WRITE filters to
-     * handle read/write events, so we need two kevents.
-     */
-    const int changes = 2;
-    struct kevent kev[changes];
-    int flags = 0;
-    int read_flags, write_flags;
+    struct kevent kev[2], res[2];
+    int i, n, found, flags, changes = 0;
+    uint32_t events;
 
     if ((!event && op != EPOLL_CTL_DEL) ||
         (op != EPOLL_CTL_ADD &&
@@ -48,111 +122,244 @@ ff_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
     }
 
     /*
-     * EPOLL_CTL_DEL doesn't need to care for event->events.
+     * Same as linux, EPOLLEXCLUSIVE is only accepted by EPOLL_CTL_ADD and
+     * not together with EPOLLONESHOT.
+     * All epoll instances of a process run on the one thread of its stack,
+     * so there is no herd of waiters to wake, it has nothing else to do.
      */
-    if (op == EPOLL_CTL_DEL) {
-        EV_SET(&kev[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-        EV_SET(&kev[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    if (op != EPOLL_CTL_DEL && (event->events & EPOLLEXCLUSIVE) &&
+        (op == EPOLL_CTL_MOD || (event->events & EPOLLONESHOT))) {
+        errno = EINVAL;
+        return -1;
+    }
 
-        return ff_kevent(epfd, kev, changes, NULL, 0, NULL);
+    found = epoll_kev_check(epfd, fd, 1, 1, op != EPOLL_CTL_DEL);
+    if (found < 0)
+        return -1;
+    if (op == EPOLL_CTL_ADD ? found : !found) {
+        errno = op == EPOLL_CTL_ADD ? EEXIST : ENOENT;
+        return -1;
     }
+    if (op == EPOLL_CTL_DEL)
+        return 0;
+
+    events = event->events;
 
     /*
-     * FIXME:
-     *
-     * Kqueue doesn't have edge-triggered mode that exactly
-     * same with epoll, the most similar way is setting EV_CLEAR
-     * or EV_DISPATCH flag, but there are still some differences.
-     *
-     * EV_CLEAR:after the event is retrieved by the user,
-     *    its state is reset.
-     * EV_DISPATCH: disable the event source immediately
-     *    after delivery of an event.
-     *
-     * Here we use EV_CLEAR temporarily.
-     *
+     * EPOLLET: EV_CLEAR resets the knote once reported, it's triggered
+     * again by the next change of the socket buffer (new data, freed space),
+     * as the linux edge-triggered mode is.
+     * EPOLLONESHOT: EV_DISPATCH disables the knote once reported, and
+     * ff_epoll_wait() disables the other direction of the fd.
      */
-    if (event->events & EPOLLET) {
+    flags = EV_ADD | EV_ENABLE | EV_RECEIPT;
+    if (events & EPOLLET) {
         flags |= EV_CLEAR;
     }
 
-    if (event->events & EPOLLONESHOT) {
-        flags |= EV_ONESHOT;
+    if (events & EPOLLONESHOT) {
+        flags |= EV_DISPATCH;
     }
 
-    if (op == EPOLL_CTL_ADD) {
-        flags |= EV_ADD;
+    /*
+     * MOD updates what's registered in place, also EPOLLET/EPOLLONESHOT
+     * and the mask, and EV_ENABLE rearms a fired EPOLLONESHOT; a direction
+     * no longer wanted is only deleted once the others are set.
+     */
+    // Fix #124: set user data
+    if (EPOLL_WANT_READ(events)) {
+        EV_SET(&kev[changes], fd, EVFILT_READ, flags, 0, 0, event->data.ptr);
+        kev[changes].ext[EPOLL_KEV_OP] = ff_KEV_EPOLL_MOD;
+        kev[changes++].ext[EPOLL_KEV_MASK] = events;
     }
 
-    read_flags = write_flags = flags | EV_DISABLE;
-
-    if (event->events & EPOLLIN) {
-        read_flags &= ~EV_DISABLE;
-        read_flags |= EV_ENABLE;
+    if (EPOLL_WANT_WRITE(events)) {
+        EV_SET(&kev[changes], fd, EVFILT_WRITE, flags, 0, 0, event->data.ptr);
+        kev[changes].ext[EPOLL_KEV_OP] = ff_KEV_EPOLL_MOD;
+        kev[changes++].ext[EPOLL_KEV_MASK] = events;
     }
 
-    if (event->events & EPOLLOUT) {
-        write_flags &= ~EV_DISABLE;
-        write_flags |= EV_ENABLE;
+    n = ff_kevent(epfd, kev, changes, res, changes, NULL);
+    if (n < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (res[i].data) {
+            /* nothing was registered before an ADD */
+            if (op == EPOLL_CTL_ADD)
+                epoll_kev_check(epfd, fd, 1, 1, 0);
+            errno = res[i].data;
+            return -1;
+        }
     }
 
-    // Fix #124: set user data
-    EV_SET(&kev[0], fd, EVFILT_READ, read_flags, 0, 0, event->data.ptr);
-    EV_SET(&kev[1], fd, EVFILT_WRITE, write_flags, 0, 0, event->data.ptr);
+    if (op == EPOLL_CTL_MOD && epoll_kev_check(epfd, fd,
+        !EPOLL_WANT_READ(events), !EPOLL_WANT_WRITE(events), 0) < 0)
+        return -1;
 
-    return ff_kevent(epfd, kev, changes, NULL, 0, NULL);
+    return 0;
 }
 
-static void 
-ff_event_to_epoll(void **ev, struct kevent *kev)
+static uint32_t
+ff_kev_to_events(const struct kevent *kev)
 {
-    unsigned int event_one = 0;
-    struct epoll_event **ppev = (struct epoll_event **)ev;
+    uint32_t mask = kev->ext[EPOLL_KEV_MASK];
+    uint32_t events = 0;
+
+    if (kev->flags & EV_ERROR) {
+        events |= EPOLLERR;
+    }
 
     if (kev->filter == EVFILT_READ) {
         if (kev->data || !(kev->flags & EV_EOF)) {
-            event_one |= EPOLLIN;
+            events |= EPOLLIN;
+        }
+
+        /*
+         * A FIN only shuts the read side down, which is EPOLLRDHUP,
+         * apps that don't ask for it still get EPOLLHUP as before.
+         * With so_error set (reset), the connection is gone.
+         */
+        if (kev->flags & EV_EOF) {
+            events |= EPOLLIN | EPOLLRDHUP;
+
+            if (kev->fflags) {
+                events |= EPOLLHUP | EPOLLERR;
+            } else if (!(mask & EPOLLRDHUP)) {
+                events |= EPOLLHUP;
+            }
         }
     } else if (kev->filter == EVFILT_WRITE) {
-        event_one |= EPOLLOUT;
-    }
+        events |= EPOLLOUT;
 
-    if (kev->flags & EV_ERROR) {
-        event_one |= EPOLLERR;
+        if (kev->flags & EV_EOF) {
+            events |= EPOLLHUP | EPOLLERR;
+        }
     }
 
-    if (kev->flags & EV_EOF) {
-        event_one |= EPOLLHUP;
+    /* EPOLLERR and EPOLLHUP are always reported, as linux does */
+    return events & (mask | EPOLLERR | EPOLLHUP);
+}
+
+static void
+ff_event_to_epoll(void **ev __attribute__((__unused__)), struct kevent *kev)
+{
+    struct epoll_slot *slot;
+    struct epoll_event *pev;
+    uint32_t events, mask, h;
+
+    events = ff_kev_to_events(kev);
+    if (events == 0) {
+        return;
+    }
 
-        if (kev->fflags) {
-            event_one |= EPOLLERR;
+    h = (uint32_t)((uint64_t)kev->ident * 0x9e3779b97f4a7c15ULL >> 32);
+    for (;; h++) {
+        slot = &epoll_merge.slots[h & epoll_merge.slot_mask];
+        if (slot->gen != epoll_merge.gen) {
+            break;
         }
 
-        if (kev->filter == EVFILT_READ) {
-            event_one |= EPOLLIN;
-        } else if (kev->filter == EVFILT_WRITE) {
-            event_one |= EPOLLERR;
+        if (slot->ident == kev->ident) {
+            epoll_merge.events[slot->idx].events |= events;
+            return;
         }
     }
 
-    (*ppev)->events   = event_one;
+    slot->gen = epoll_merge.gen;
+    slot->ident = kev->ident;
+    slot->idx = epoll_merge.nevents;
+
+    pev = &epoll_merge.events[epoll_merge.nevents++];
+    pev->events = events;
     // Fix #124: get user data
     if (kev->udata != NULL)
-        (*ppev)->data.ptr  = kev->udata;
+        pev->data.ptr = kev->udata;
     else
-        (*ppev)->data.fd = kev->ident;
-    (*ppev)++;
+        pev->data.fd = kev->ident;
+
+    mask = kev->ext[EPOLL_KEV_MASK];
+    if ((kev->flags & EV_DISPATCH) && EPOLL_WANT_READ(mask) &&
+        EPOLL_WANT_WRITE(mask)) {
+        EV_SET(&epoll_merge.disables[epoll_merge.ndisables++], kev->ident,
+            kev->filter == EVFILT_READ ? EVFILT_WRITE : EVFILT_READ,
+            EV_DISABLE, 0, 0, NULL);
+    }
+}
+
+static int
+epoll_merge_init(struct epoll_event *events, int maxevents)
+{
+    struct epoll_slot *slots;
+    struct kevent *disables;
+    uint32_t n;
+
+    if (maxevents > epoll_merge.cap) {
+        for (n = 1; n < (uint32_t)maxevents * 2; n <<= 1)
+            ;
+
+        slots = calloc(n, sizeof(struct epoll_slot));
+        disables = malloc(maxevents * sizeof(struct kevent));
+        if (slots == NULL || disables == NULL) {
+            free(slots);
+            free(disables);
+            return -1;
+        }
+
+        free(epoll_merge.slots);
+        free(epoll_merge.disables);
+        epoll_merge.slots = slots;
+        epoll_merge.disables = disables;
+        epoll_merge.slot_mask = n - 1;
+        epoll_merge.cap = maxevents;
+        epoll_merge.gen = 0;
+    }
+
+    /* A new generation empties the table, slots are zeroed on wrap */
+    if (++epoll_merge.gen == 0) {
+        memset(epoll_merge.slots, 0,
+            (epoll_merge.slot_mask + 1) * sizeof(struct epoll_slot));
+        epoll_merge.gen = 1;
+    }
+
+    epoll_merge.events = events;
+    epoll_merge.nevents = 0;
+    epoll_merge.ndisables = 0;
+
+    return 0;
 }
 
 int 
 ff_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
 {
-    int i, ret;
+    int ret;
+    struct timespec ts;
     if (!events || maxevents < 1) {
         errno = EINVAL;
         return -1;
     }
 
-    return ff_kevent_do_each(epfd, NULL, 0, events, maxevents, NULL, ff_event_to_epoll);
+    if (epoll_merge_init(events, maxevents) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+    }
+
+    ret = ff_kevent_do_each(epfd, NULL, 0, events, maxevents,
+        timeout >= 0 ? &ts : NULL, ff_event_to_epoll);
+    if (ret < 0) {
+        return -1;
+    }
+
+    if (epoll_merge.ndisables) {
+        ff_kevent(epfd, epoll_merge.disables, epoll_merge.ndisables,
+            NULL, 0, NULL);
+    }
+
+    return epoll_merge.nevents;
 }
 
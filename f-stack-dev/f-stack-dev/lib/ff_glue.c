@@ -58,6 +58,7 @@
 #include <sys/eventfd.h>
 #include <sys/linker.h>
 #include <sys/sleepqueue.h>
+#include <sys/sbuf.h>
 
 #include <vm/vm.h>
 #include <vm/vm_param.h>
@@ -68,6 +69,8 @@
 #include <vm/vm_domainset.h>
 #include <vm/vm_page.h>
 #include <vm/vm_pagequeue.h>
+#include <vm/uma.h>
+#include <vm/uma_int.h>
 
 #include <netinet/in_systm.h>
 
@@ -1028,6 +1031,29 @@ kmem_free(vm_offset_t addr, vm_size_t size)
     ff_munmap((void *)addr, size);
 }
 
+static SYSCTL_NODE(_vm, OID_AUTO, hugemem, CTLFLAG_RD, NULL,
+    "Stack memory in hugepages");
+
+static int
+sysctl_vm_hugemem(SYSCTL_HANDLER_ARGS)
+{
+    uint64_t val[5];
+
+    ff_kmem_stats(&val[0], &val[1], &val[2], &val[3], &val[4]);
+    return (sysctl_handle_64(oidp, &val[arg2], 0, req));
+}
+
+SYSCTL_PROC(_vm_hugemem, OID_AUTO, limit, CTLFLAG_RD | CTLTYPE_U64, NULL, 0,
+    sysctl_vm_hugemem, "QU", "Bytes of hugepages the stack may use");
+SYSCTL_PROC(_vm_hugemem, OID_AUTO, reserved, CTLFLAG_RD | CTLTYPE_U64, NULL, 1,
+    sysctl_vm_hugemem, "QU", "Bytes of hugepages reserved");
+SYSCTL_PROC(_vm_hugemem, OID_AUTO, in_use, CTLFLAG_RD | CTLTYPE_U64, NULL, 2,
+    sysctl_vm_hugemem, "QU", "Bytes of hugepages in use");
+SYSCTL_PROC(_vm_hugemem, OID_AUTO, peak, CTLFLAG_RD | CTLTYPE_U64, NULL, 3,
+    sysctl_vm_hugemem, "QU", "Most bytes of hugepages in use");
+SYSCTL_PROC(_vm_hugemem, OID_AUTO, fallbacks, CTLFLAG_RD | CTLTYPE_U64, NULL, 4,
+    sysctl_vm_hugemem, "QU", "Allocations that took host pages over the limit");
+
 vm_offset_t
 kmem_alloc_contig(vm_size_t size, int flags, vm_paddr_t low,
     vm_paddr_t high, u_long alignment, vm_paddr_t boundary, vm_memattr_t memattr)
@@ -1035,23 +1061,239 @@ kmem_alloc_contig(vm_size_t size, int flags, vm_paddr_t low,
     return (kmem_malloc(size, flags));
 }
 
+/*
+ * malloc(9) is served from UMA zones of fixed sizes as in kern_malloc.c,
+ * so that small allocations are taken from the per cpu caches of a zone
+ * instead of the host allocator, and from hugepages with hugemem_MB.
+ * Larger ones take whole pages from kmem_malloc(). free(9) finds the zone
+ * or the size of a large allocation through the page of the address.
+ *
+ * Until the zones are created, and for whatever was allocated before,
+ * the host allocator is still used.
+ */
+#define KMEM_ZSHIFT    4
+#define KMEM_ZBASE     16
+#define KMEM_ZMASK     (KMEM_ZBASE - 1)
+
+#define KMEM_ZMAX      65536
+#define KMEM_ZSIZE     (KMEM_ZMAX >> KMEM_ZSHIFT)
+static uint8_t kmemsize[KMEM_ZSIZE + 1];
+
+#define REALLOC_FRACTION    1
+
+static struct {
+    int kz_size;
+    const char *kz_name;
+    uma_zone_t kz_zone;
+} kmemzones[] = {
+    {16, "malloc-16", },
+    {32, "malloc-32", },
+    {64, "malloc-64", },
+    {128, "malloc-128", },
+    {256, "malloc-256", },
+    {384, "malloc-384", },
+    {512, "malloc-512", },
+    {1024, "malloc-1024", },
+    {2048, "malloc-2048", },
+    {4096, "malloc-4096", },
+    {8192, "malloc-8192", },
+    {16384, "malloc-16384", },
+    {32768, "malloc-32768", },
+    {65536, "malloc-65536", },
+    {0, NULL},
+};
+
+static int kmem_ready;
+static uma_zone_t mt_stats_zone;
+
+/*
+ * The malloc_mtx protects the kmemstatistics linked list.
+ */
+struct mtx malloc_mtx;
+static struct malloc_type *kmemstatistics;
+static int kmemcount;
+
+static SYSCTL_NODE(_vm, OID_AUTO, malloc, CTLFLAG_RD, 0,
+    "Malloc information");
+
+static u_int vm_malloc_zone_count = nitems(kmemzones);
+SYSCTL_UINT(_vm_malloc, OID_AUTO, zone_count, CTLFLAG_RD,
+    &vm_malloc_zone_count, 0, "Number of malloc zones");
+
+static int
+sysctl_vm_malloc_zone_sizes(SYSCTL_HANDLER_ARGS)
+{
+    int sizes[nitems(kmemzones)];
+    int i;
+
+    for (i = 0; i < nitems(kmemzones); i++) {
+        sizes[i] = kmemzones[i].kz_size;
+    }
+
+    return (SYSCTL_OUT(req, &sizes, sizeof(sizes)));
+}
+
+SYSCTL_PROC(_vm_malloc, OID_AUTO, zone_sizes,
+    CTLFLAG_RD | CTLTYPE_OPAQUE, NULL, 0,
+    sysctl_vm_malloc_zone_sizes, "S", "Zone sizes used by malloc");
+
+static void
+mallocinit(void *dummy)
+{
+    int i;
+    uint8_t indx;
+
+    mtx_init(&malloc_mtx, "malloc", NULL, MTX_DEF);
+
+    mt_stats_zone = uma_zcreate("mt_stats", sizeof(struct malloc_type_stats),
+        NULL, NULL, NULL, NULL, UMA_ALIGN_PTR, 0);
+
+    for (i = 0, indx = 0; kmemzones[indx].kz_size != 0; indx++) {
+        int size = kmemzones[indx].kz_size;
+        size_t align;
+
+        align = UMA_ALIGN_PTR;
+        if (powerof2(size) && size > sizeof(void *))
+            align = MIN(size, PAGE_SIZE) - 1;
+        kmemzones[indx].kz_zone = uma_zcreate(kmemzones[indx].kz_name,
+            size, NULL, NULL, NULL, NULL, align, UMA_ZONE_MALLOC);
+        for (;i <= size; i+= KMEM_ZBASE)
+            kmemsize[i >> KMEM_ZSHIFT] = indx;
+    }
+
+    kmem_ready = 1;
+}
+SYSINIT(kmem, SI_SUB_KMEM, SI_ORDER_SECOND, mallocinit, NULL);
+
 void
 malloc_init(void *data)
 {
-    /* Nothing to do here */ 
-}
+    struct malloc_type *mtp = data;
+
+    if (mtp->ks_version != M_VERSION)
+        panic("malloc_init: type %s with unsupported version %lu",
+            mtp->ks_shortdesc, mtp->ks_version);
 
+    mtp->ks_mti.mti_stats = uma_zalloc(mt_stats_zone, M_WAITOK | M_ZERO);
+
+    mtx_lock(&malloc_mtx);
+    mtp->ks_next = kmemstatistics;
+    kmemstatistics = mtp;
+    kmemcount++;
+    mtx_unlock(&malloc_mtx);
+}
 
 void
 malloc_uninit(void *data)
 {
-    /* Nothing to do here */ 
+    struct malloc_type_stats *mtsp;
+    struct malloc_type *mtp, *temp;
+
+    mtp = data;
+    mtx_lock(&malloc_mtx);
+    if (mtp != kmemstatistics) {
+        for (temp = kmemstatistics; temp != NULL; temp = temp->ks_next) {
+            if (temp->ks_next == mtp) {
+                temp->ks_next = mtp->ks_next;
+                break;
+            }
+        }
+    } else
+        kmemstatistics = mtp->ks_next;
+    kmemcount--;
+    mtx_unlock(&malloc_mtx);
+
+    mtsp = mtp->ks_mti.mti_stats;
+    if (mtsp == NULL)
+        return;
+
+    if (mtsp->mts_numallocs > mtsp->mts_numfrees) {
+        printf("Warning: memory type %s leaked memory on destroy "
+            "(%ld allocations, %ld bytes leaked).\n", mtp->ks_shortdesc,
+            (long)(mtsp->mts_numallocs - mtsp->mts_numfrees),
+            (long)(mtsp->mts_memalloced - mtsp->mts_memfreed));
+    }
+
+    mtp->ks_mti.mti_stats = NULL;
+    uma_zfree(mt_stats_zone, mtsp);
+}
+
+static void
+malloc_type_count_alloc(struct malloc_type *mtp, unsigned long size, int zindx)
+{
+    struct malloc_type_stats *mtsp = mtp->ks_mti.mti_stats;
+
+    if (mtsp == NULL)
+        return;
+
+    mtsp->mts_memalloced += size;
+    mtsp->mts_numallocs++;
+    if (zindx != -1)
+        mtsp->mts_size |= 1 << zindx;
+}
+
+static void
+malloc_type_count_free(struct malloc_type *mtp, unsigned long size)
+{
+    struct malloc_type_stats *mtsp = mtp->ks_mti.mti_stats;
+
+    if (mtsp == NULL)
+        return;
+
+    mtsp->mts_memfreed += size;
+    mtsp->mts_numfrees++;
+}
+
+/* Large allocations record their size in place of the slab of the page */
+#define malloc_large_slab(slab)  (((uintptr_t)(slab) & 1) != 0)
+#define malloc_large_size(slab)  ((uintptr_t)(slab) >> 1)
+
+static void *
+malloc_large(unsigned long size, struct malloc_type *mtp, int flags)
+{
+    void *va;
+
+    size = roundup(size, PAGE_SIZE);
+    va = (void *)kmem_malloc(size, flags);
+    if (va != NULL) {
+        vsetzoneslab((vm_offset_t)va, NULL, (void *)((size << 1) | 1));
+        malloc_type_count_alloc(mtp, size, -1);
+    }
+
+    return (va);
+}
+
+/* NULL slab: not from malloc(9), but from the host before the zones */
+static void
+malloc_lookup(void *addr, uma_zone_t *zone, uma_slab_t *slab)
+{
+    if (!kmem_ready) {
+        *zone = NULL;
+        *slab = NULL;
+        return;
+    }
+
+    vtozoneslab((vm_offset_t)addr & ~(PAGE_SIZE - 1), zone, slab);
 }
 
 void *
 malloc(unsigned long size, struct malloc_type *type, int flags)
 {
     void *alloc;
+    uint8_t indx;
+
+    if (kmem_ready) {
+        if (size > KMEM_ZMAX)
+            return (malloc_large(size, type, flags));
+
+        if (size & KMEM_ZMASK)
+            size = (size & ~KMEM_ZMASK) + KMEM_ZBASE;
+        indx = kmemsize[size >> KMEM_ZSHIFT];
+        alloc = uma_zalloc(kmemzones[indx].kz_zone, flags);
+        if (alloc != NULL)
+            malloc_type_count_alloc(type, kmemzones[indx].kz_size, indx);
+        return (alloc);
+    }
 
     do {
         alloc = ff_malloc(size);
@@ -1069,14 +1311,61 @@ malloc(unsigned long size, struct malloc_type *type, int flags)
 void
 free(void *addr, struct malloc_type *type)
 {
-    ff_free(addr);
+    uma_zone_t zone;
+    uma_slab_t slab;
+    unsigned long size;
+
+    if (addr == NULL)
+        return;
+
+    malloc_lookup(addr, &zone, &slab);
+    if (slab == NULL) {
+        ff_free(addr);
+        return;
+    }
+
+    if (!malloc_large_slab(slab)) {
+        size = zone->uz_size;
+        uma_zfree_arg(zone, addr, slab);
+    } else {
+        size = malloc_large_size(slab);
+        kmem_free((vm_offset_t)addr, size);
+    }
+    malloc_type_count_free(type, size);
 }
 
 void *
 realloc(void *addr, unsigned long size, struct malloc_type *type,
     int flags)
 {
-    return (ff_realloc(addr, size));
+    uma_zone_t zone;
+    uma_slab_t slab;
+    unsigned long alloc;
+    void *newaddr;
+
+    if (addr == NULL)
+        return (malloc(size, type, flags));
+
+    malloc_lookup(addr, &zone, &slab);
+    if (slab == NULL)
+        return (ff_realloc(addr, size));
+
+    if (!malloc_large_slab(slab))
+        alloc = zone->uz_size;
+    else
+        alloc = malloc_large_size(slab);
+
+    /* Reuse the original block if appropriate */
+    if (size <= alloc &&
+        (size > (alloc >> REALLOC_FRACTION) || alloc == MINALLOCSIZE))
+        return (addr);
+
+    if ((newaddr = malloc(size, type, flags)) == NULL)
+        return (NULL);
+
+    bcopy(addr, newaddr, min(size, alloc));
+    free(addr, type);
+    return (newaddr);
 }
 
 void *
@@ -1085,12 +1374,61 @@ reallocf(void *addr, unsigned long size, struct malloc_type *type,
 {
     void *mem;
 
-    if ((mem = ff_realloc(addr, size)) == NULL)
-        ff_free(addr);
+    if ((mem = realloc(addr, size, type, flags)) == NULL)
+        free(addr, type);
 
     return (mem);
 }
 
+static int
+sysctl_kern_malloc_stats(SYSCTL_HANDLER_ARGS)
+{
+    struct malloc_type_stream_header mtsh;
+    struct malloc_type_stats *mtsp, zeromts;
+    struct malloc_type_header mth;
+    struct malloc_type *mtp;
+    struct sbuf sbuf;
+    int error;
+
+    error = sysctl_wire_old_buffer(req, 0);
+    if (error != 0)
+        return (error);
+    sbuf_new_for_sysctl(&sbuf, NULL, 128, req);
+    sbuf_clear_flags(&sbuf, SBUF_INCLUDENUL);
+    mtx_lock(&malloc_mtx);
+
+    bzero(&zeromts, sizeof(zeromts));
+
+    bzero(&mtsh, sizeof(mtsh));
+    mtsh.mtsh_version = MALLOC_TYPE_STREAM_VERSION;
+    /* the lcore of the process is the only cpu, keep the stream short */
+    mtsh.mtsh_maxcpus = 1;
+    mtsh.mtsh_count = kmemcount;
+    (void)sbuf_bcat(&sbuf, &mtsh, sizeof(mtsh));
+
+    for (mtp = kmemstatistics; mtp != NULL; mtp = mtp->ks_next) {
+        bzero(&mth, sizeof(mth));
+        strlcpy(mth.mth_name, mtp->ks_shortdesc, MALLOC_MAX_NAME);
+        (void)sbuf_bcat(&sbuf, &mth, sizeof(mth));
+
+        mtsp = mtp->ks_mti.mti_stats;
+        (void)sbuf_bcat(&sbuf, mtsp != NULL ? mtsp : &zeromts,
+            sizeof(*mtsp));
+    }
+    mtx_unlock(&malloc_mtx);
+    error = sbuf_finish(&sbuf);
+    sbuf_delete(&sbuf);
+    return (error);
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, malloc_stats,
+    CTLFLAG_RD | CTLTYPE_STRUCT, 0, 0,
+    sysctl_kern_malloc_stats, "s,malloc_type_ustats",
+    "Return malloc types");
+
+SYSCTL_INT(_kern, OID_AUTO, malloc_count, CTLFLAG_RD, &kmemcount, 0,
+    "Count of kernel malloc types");
+
 void
 DELAY(int delay)
 {
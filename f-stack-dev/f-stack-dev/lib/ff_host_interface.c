@@ -41,9 +41,12 @@
 
 #include <openssl/rand.h>
 #include <rte_malloc.h>
+#include <rte_memory.h>
 
 #include "ff_host_interface.h"
 #include "ff_errno.h"
+#include "ff_config.h"
+#include "ff_dpdk_kmem.h"
 
 static struct timespec current_ts;
 extern void* ff_mem_get_page();
@@ -64,6 +67,22 @@ ff_mmap(void *addr, uint64_t len, int prot, int flags, int fd, uint64_t offset)
 #endif
         {
 
+    if (addr == NULL && (flags & ff_MAP_ANON) == ff_MAP_ANON) {
+        void *ret = ff_kmem_alloc(len);
+        if (ret != NULL) {
+            return ret;
+        }
+    }
+
+    /* zero-copy TX hands the stack's buffers to the NIC, keep them in hugepages */
+    if (ff_global_cfg.dpdk.tx_zerocopy && addr == NULL &&
+        (flags & ff_MAP_ANON) == ff_MAP_ANON) {
+        void *ret = rte_zmalloc("ff_mmap", len, 4096);
+        if (ret != NULL) {
+            return ret;
+        }
+    }
+
     assert(ff_PROT_NONE == PROT_NONE);
     host_prot = 0;
     if ((prot & ff_PROT_READ) == ff_PROT_READ)   host_prot |= PROT_READ;
@@ -92,8 +111,14 @@ ff_munmap(void *addr, uint64_t len)
             return ff_mem_free_addr(addr);
         }
 #endif
-    //rte_free(addr);
-    //return 0;
+    if (ff_kmem_free(addr, len) == 0) {
+        return 0;
+    }
+    if (ff_global_cfg.dpdk.tx_zerocopy &&
+        rte_mem_virt2memseg_list(addr) != NULL) {
+        rte_free(addr);
+        return 0;
+    }
     return (munmap(addr, len));
 }
 
@@ -329,3 +354,8 @@ void ff_os_errno(int error)
 
 }
 
+int ff_os_get_errno(void)
+{
+    return errno;
+}
+
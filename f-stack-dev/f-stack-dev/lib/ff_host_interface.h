@@ -72,11 +72,46 @@ int ff_setenv(const char *name, const char *value);
 char *ff_getenv(const char *name);
 
 void ff_os_errno(int error);
+int ff_os_get_errno(void);
+
+/*
+ * ext[3] of the kevents of ff_epoll_ctl(): PROBE only tells whether the
+ * filter is registered, MOD also updates EV_CLEAR, EV_DISPATCH and the
+ * epoll mask in ext[2] of a registered one, which EV_ADD keeps otherwise.
+ */
+#define ff_KEV_EPOLL_PROBE  1
+#define ff_KEV_EPOLL_MOD    2
 
 int ff_in_pcbladdr(uint16_t family, void *faddr, uint16_t fport, void *laddr);
 
+/*
+ * Register a wait of the loop callback that found no events,
+ * a negative `timeout_ns` waits for an event only.
+ */
+void ff_loop_wait(int64_t timeout_ns);
+void ff_loop_wakeup(void);
+
 int ff_rss_check(void *softc, uint32_t saddr, uint32_t daddr,
     uint16_t sport, uint16_t dport);
 
+/*
+ * Neighbor cache shared by all the processes, `addr` is the in_addr or
+ * in6_addr of the neighbor and `age` the seconds since it was confirmed.
+ */
+int ff_neigh_lookup(void *softc, const void *addr, int addr_len,
+    void *lladdr, uint32_t *age);
+void ff_neigh_update(void *softc, const void *addr, int addr_len,
+    const void *lladdr);
+
+/*
+ * Non zero while dpdk mbufs run short, the stack then takes no more of
+ * them than it needs until they are back.
+ */
+int ff_mbuf_pressure(void);
+
+/* Usage of the hugepage arena behind kmem_malloc(), in bytes */
+void ff_kmem_stats(uint64_t *limit, uint64_t *reserved, uint64_t *in_use,
+    uint64_t *peak, uint64_t *fallbacks);
+
 #endif
 
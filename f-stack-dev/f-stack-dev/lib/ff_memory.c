@@ -23,6 +23,10 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  */
+
+/* rte_dev_dma_map() is still experimental in this dpdk */
+#define ALLOW_EXPERIMENTAL_API
+
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -100,6 +104,9 @@ typedef struct _list_manager_s
 
 static StackList_t         ff_mpage_ctl = {0};
 static uint64_t             ff_page_start = (uint64_t)NULL, ff_page_end = (uint64_t)NULL;
+// IOVA of the pages: one offset from their address when they are IOVA contiguous, else per page in ff_mpage_phy.
+static int                  ff_page_iova_contig = 0;
+static uint64_t             ff_page_iova_off = 0;
 static phys_addr_t        *ff_mpage_phy = NULL;
 
 static inline void        *stklist_pop(StackList_t *p);
@@ -225,24 +232,93 @@ void ff_init_ref_pool(int nb_mbuf, int socketid)
     }
 }
 
+/*
+ * Pages from a memzone are DMA mapped by DPDK like its other memory, their
+ * IOVA comes from its memseg tables without touching /proc/self/pagemap.
+ */
+static void *ff_mmap_memzone(uint64_t len)
+{
+    const struct rte_memzone *mz = NULL;
+    char name[RTE_MEMZONE_NAMESIZE];
+
+    snprintf(name, sizeof(name), "ff_page_array_%d", lcore_conf.proc_id);
+    mz = rte_memzone_lookup(name);
+    if (mz == NULL) {
+        mz = rte_memzone_reserve_aligned(name, len, lcore_conf.socket_id,
+            RTE_MEMZONE_IOVA_CONTIG, PAGE_SIZE);
+    }
+    if (mz == NULL) {
+        mz = rte_memzone_reserve_aligned(name, len, lcore_conf.socket_id,
+            0, PAGE_SIZE);
+    }
+    if (mz == NULL || mz->len < len) {
+        return NULL;
+    }
+
+    return mz->addr;
+}
+
+/*
+ * With IOVA as VA register anonymous pages as external memory and map them
+ * for the device of every port at their own address.
+ */
+static int ff_mmap_extmem(void *addr, uint64_t len)
+{
+    struct rte_eth_dev_info dev_info;
+    uint16_t port_id;
+    int i;
+
+    if (rte_extmem_register(addr, len, NULL, 0, PAGE_SIZE) < 0 && rte_errno != EEXIST) {
+        return -1;
+    }
+
+    for (i = 0; i < ff_global_cfg.dpdk.nb_ports; i++) {
+        port_id = ff_global_cfg.dpdk.portid_list[i];
+        if (rte_eth_dev_info_get(port_id, &dev_info) != 0) {
+            return -1;
+        }
+        // devices sharing a VFIO container have it mapped already, vdevs do no DMA.
+        if (rte_dev_dma_map(dev_info.device, addr, (uint64_t)addr, len) < 0 &&
+            rte_errno != EEXIST && rte_errno != ENOTSUP) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 int ff_mmap_init()
 {
-    int err = 0;
     int i = 0;
     uint64_t    virt_addr = (uint64_t)NULL;
-    phys_addr_t    phys_addr = 0;
+    rte_iova_t    iova = RTE_BAD_IOVA;
     uint64_t    bsd_memsz = (ff_global_cfg.freebsd.mem_size << 20);
     unsigned int bsd_pagesz = 0;
-    
-    ff_page_start = (uint64_t)mmap( NULL, bsd_memsz, PROT_READ | PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
-    if (ff_page_start == (uint64_t)-1){
-        rte_panic("ff_mmap_init get ff_page_start failed, err=%d.\n", errno);
-        return -1;
-    }
-    
-    if ( mlock((void*)ff_page_start, bsd_memsz)<0 )    {
-        rte_panic("mlock failed, err=%d.\n", errno);
-        return -1;
+    int         extmem = 0;
+
+    ff_page_start = (uint64_t)ff_mmap_memzone(bsd_memsz);
+    if (ff_page_start == (uint64_t)NULL) {
+        rte_log(RTE_LOG_WARNING, RTE_LOGTYPE_USER1, "ff_mmap_init no memzone of %d MB, using anonymous pages.\n",
+            ff_global_cfg.freebsd.mem_size);
+
+        ff_page_start = (uint64_t)mmap( NULL, bsd_memsz, PROT_READ | PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+        if (ff_page_start == (uint64_t)-1){
+            rte_panic("ff_mmap_init get ff_page_start failed, err=%d.\n", errno);
+            return -1;
+        }
+
+        if ( mlock((void*)ff_page_start, bsd_memsz)<0 )    {
+            rte_panic("mlock failed, err=%d.\n", errno);
+            return -1;
+        }
+
+        if (rte_eal_iova_mode() == RTE_IOVA_VA) {
+            if (ff_mmap_extmem((void*)ff_page_start, bsd_memsz) < 0) {
+                rte_panic("ff_mmap_init map external memory failed, err=%d.\n", rte_errno);
+                return -1;
+            }
+            extmem = 1;
+        }
     }
     ff_page_end = ff_page_start + bsd_memsz;
     bsd_pagesz = (bsd_memsz>>12);
@@ -253,43 +329,70 @@ int ff_mmap_init()
         rte_panic("posix_memalign get ff_mpage_phy failed, err=%d.\n", errno);
         return -1;
     }
-    
+
     stklist_init(&ff_mpage_ctl, bsd_pagesz);
-    
+
+    ff_page_iova_contig = 1;
     for (i=0; i<bsd_pagesz; i++ ){
         virt_addr = ff_page_start + PAGE_SIZE*i;
         memset((void*)virt_addr, 0, PAGE_SIZE);
-        
+
         stklist_push( &ff_mpage_ctl, virt_addr);
-        ff_mpage_phy[i] = rte_mem_virt2phy((const void*)virt_addr);
-        if ( ff_mpage_phy[i] == RTE_BAD_IOVA ){
-            rte_panic("rte_mem_virt2phy return invalid address.");
+        if (extmem) {
+            iova = virt_addr;
+        } else if (rte_mem_virt2memseg_list((const void*)virt_addr) != NULL) {
+            iova = rte_mem_virt2iova((const void*)virt_addr);
+        } else {
+            // IOVA as PA, needs CAP_SYS_ADMIN to read the pagemap.
+            iova = rte_mem_virt2phy((const void*)virt_addr);
+        }
+        if ( iova == RTE_BAD_IOVA ){
+            rte_panic("ff_mmap_init get invalid iova of 0x%lx.", virt_addr);
             return -1;
         }
+        ff_mpage_phy[i] = iova;
+        if (ff_mpage_phy[i] != ff_mpage_phy[0] + (uint64_t)PAGE_SIZE*i) {
+            ff_page_iova_contig = 0;
+        }
     }
 
+    if (ff_page_iova_contig) {
+        ff_page_iova_off = ff_mpage_phy[0] - ff_page_start;
+        free(ff_mpage_phy);
+        ff_mpage_phy = NULL;
+    }
+    printf("ff_mmap_init iova %s\n", ff_page_iova_contig ? "contiguous" : "per page");
+
     ff_txring_init(&nic_tx_ring[0], RTE_MAX_ETHPORTS);
-    
+
     return 0;
 }
 
 // 1: vma in fstack page table;  0: vma not in fstack pages, in DPDK pool.
 static inline int ff_chk_vma(const uint64_t virtaddr)
 {
-    return  !!( virtaddr > ff_page_start && virtaddr < ff_page_end );
+    return  !!( virtaddr >= ff_page_start && virtaddr < ff_page_end );
 }
 
 /*
- * Get physical address of any mapped virtual address in the current process.
+ * Get the IOVA of an address, in the page array or else in DPDK memory.
  */
-static inline uint64_t ff_mem_virt2phy(const void* virtaddr)
+static inline rte_iova_t ff_mem_virt2iova(const void* virtaddr)
 {
     uint64_t    addr = 0;
     uint32_t    pages = 0;
 
+    if (unlikely(!ff_chk_vma((const uint64_t)virtaddr))) {
+        return rte_mem_virt2iova(virtaddr);
+    }
+
+    if (likely(ff_page_iova_contig)) {
+        return (uint64_t)virtaddr + ff_page_iova_off;
+    }
+
     pages = (((uint64_t)virtaddr - (uint64_t)ff_page_start)>>PAGE_SHIFT);
     if (pages >= stklist_size(&ff_mpage_ctl)){
-        rte_panic("ff_mbuf_virt2phy get invalid pages %d.", pages);
+        rte_panic("ff_mem_virt2iova get invalid pages %d.", pages);
         return -1;
     }
     
@@ -310,69 +413,10 @@ int    ff_mem_free_addr(void *p)
 
 static inline void ff_offload_set(struct ff_dpdk_if_context *ctx, void *m, struct rte_mbuf *head)
 {
-    void                    *data = NULL;
     struct ff_tx_offload     offload = {0};
-    
-    ff_mbuf_tx_offload(m, &offload);
-    data = rte_pktmbuf_mtod(head, void*);
-
-    if (offload.ip_csum) {
-        /* ipv6 not supported yet */
-        struct rte_ipv4_hdr *iph;
-        int iph_len;
-        iph = (struct rte_ipv4_hdr *)(data + RTE_ETHER_HDR_LEN);
-        iph_len = (iph->version_ihl & 0x0f) << 2;
-
-        head->ol_flags |= PKT_TX_IP_CKSUM | PKT_TX_IPV4;
-        head->l2_len = RTE_ETHER_HDR_LEN;
-        head->l3_len = iph_len;
-    }
 
-    if (ctx->hw_features.tx_csum_l4) {
-        struct rte_ipv4_hdr *iph;
-        int iph_len;
-        iph = (struct rte_ipv4_hdr *)(data + RTE_ETHER_HDR_LEN);
-        iph_len = (iph->version_ihl & 0x0f) << 2;
-
-        if (offload.tcp_csum) {
-            head->ol_flags |= PKT_TX_TCP_CKSUM;
-            head->l2_len = RTE_ETHER_HDR_LEN;
-            head->l3_len = iph_len;
-        }
-
-       /*
-         *  TCP segmentation offload.
-         *
-         *  - set the PKT_TX_TCP_SEG flag in mbuf->ol_flags (this flag
-         *    implies PKT_TX_TCP_CKSUM)
-         *  - set the flag PKT_TX_IPV4 or PKT_TX_IPV6
-         *  - if it's IPv4, set the PKT_TX_IP_CKSUM flag and
-         *    write the IP checksum to 0 in the packet
-         *  - fill the mbuf offload information: l2_len,
-         *    l3_len, l4_len, tso_segsz
-         *  - calculate the pseudo header checksum without taking ip_len
-         *    in account, and set it in the TCP header. Refer to
-         *    rte_ipv4_phdr_cksum() and rte_ipv6_phdr_cksum() that can be
-         *    used as helpers.
-         */
-        if (offload.tso_seg_size) {
-            struct rte_tcp_hdr *tcph;
-            int tcph_len;
-            tcph = (struct rte_tcp_hdr *)((char *)iph + iph_len);
-            tcph_len = (tcph->data_off & 0xf0) >> 2;
-            tcph->cksum = rte_ipv4_phdr_cksum(iph, PKT_TX_TCP_SEG);
-
-            head->ol_flags |= PKT_TX_TCP_SEG;
-            head->l4_len = tcph_len;
-            head->tso_segsz = offload.tso_seg_size;
-        }
-
-        if (offload.udp_csum) {
-            head->ol_flags |= PKT_TX_UDP_CKSUM;
-            head->l2_len = RTE_ETHER_HDR_LEN;
-            head->l3_len = iph_len;
-        }
-    }
+    ff_mbuf_tx_offload(m, &offload);
+    ff_tx_offload_set(ctx, head, &offload);
 }
 
 // create rte_buf refer to data which is transmit from bsd stack by EXT_CLUSTER.
@@ -422,7 +466,15 @@ static inline struct rte_mbuf*     ff_bsd_to_rte(void *m, int total)
         }
         ff_next_mbuf(&p_bsdbuf, &data, &len);        // p_bsdbuf move to next mbuf.
         cur->buf_addr = data;
-        cur->buf_iova = ff_mem_virt2phy((const void*)(cur->buf_addr));
+        cur->buf_iova = ff_mem_virt2iova((const void*)(cur->buf_addr));
+        if (unlikely(cur->buf_iova == RTE_BAD_IOVA)) {
+            // neither in the page array nor in DPDK memory, the NIC can't reach it.
+            if (cur != p_head) {
+                rte_pktmbuf_free_seg(cur);
+            }
+            rte_pktmbuf_free(p_head);
+            return NULL;
+        }
         cur->data_off = 0;
         cur->data_len = len;        
 
@@ -89,9 +89,15 @@ struct lcore_conf {
     uint16_t tx_port_id[RTE_MAX_ETHPORTS];
     uint16_t tx_queue_id[RTE_MAX_ETHPORTS];
     struct mbuf_table tx_mbufs[RTE_MAX_ETHPORTS];
+    /* packets of one rx burst staged per dispatch ring, flushed in bulk */
+    struct mbuf_table dispatch_mbufs[DPDK_MAX_LCORE];
     //char *pcap[RTE_MAX_ETHPORTS];
 } __rte_cache_aligned;
 
+struct ff_tx_offload;
+void ff_tx_offload_set(struct ff_dpdk_if_context *ctx, struct rte_mbuf *head,
+    const struct ff_tx_offload *offload);
+
 #ifdef FF_USE_PAGE_ARRAY
 //  mbuf_txring save mbuf which had bursted into NIC,  m_tables has same length with NIC dev's sw_ring.
 //  Then when txring.m_table[x] is reused, the packet in txring.m_table[x] had been transmited by NIC.
@@ -27,10 +27,10 @@
 #ifndef _FF_MSG_H_
 #define _FF_MSG_H_
 
+#include <stddef.h>
 #include <rte_memory.h>
 
 #define FF_MSG_RING_IN  "ff_msg_ring_in_"
-#define FF_MSG_RING_OUT "ff_msg_ring_out_"
 #define FF_MSG_POOL     "ff_msg_pool"
 
 /* MSG TYPE: sysctl, ioctl, etc.. */
@@ -45,6 +45,8 @@ enum FF_MSG_TYPE {
     FF_IPFW_CTL,
     FF_TRAFFIC,
     FF_KNICTL,
+    FF_PCAP,
+    FF_LATENCY,
 
     /*
      * to add other msg type before FF_MSG_NUM
@@ -52,6 +54,21 @@ enum FF_MSG_TYPE {
     FF_MSG_NUM,
 };
 
+/*
+ * ff_msg.state, also the futex word a requester sleeps on. The requester
+ * sets PENDING before enqueueing and may move it to WAITING before it
+ * sleeps; the owning process moves it to DONE and only wakes the futex if
+ * it saw WAITING. A requester that gives up moves it to ABANDONED and the
+ * owning process frees the message when it completes; the requester
+ * remembers it gave the message up, whatever state it reads later.
+ */
+enum FF_MSG_STATE {
+    FF_MSG_PENDING = 0,
+    FF_MSG_WAITING,
+    FF_MSG_DONE,
+    FF_MSG_ABANDONED,
+};
+
 struct ff_sysctl_args {
     int *name;
     unsigned namelen;
@@ -100,11 +117,21 @@ struct ff_ipfw_args {
     socklen_t *optlen;
 };
 
+/* Max queues counted by the software dispatch statistics */
+#define FF_MAX_DISPATCH_QUEUES 128
+
 struct ff_traffic_args {
     uint64_t rx_packets;
     uint64_t rx_bytes;
     uint64_t tx_packets;
     uint64_t tx_bytes;
+
+    /*
+     * Packets this process handed to each queue's dispatch ring, and
+     * the ones dropped there because the ring was full.
+     */
+    uint64_t dispatch_packets[FF_MAX_DISPATCH_QUEUES];
+    uint64_t dispatch_drops[FF_MAX_DISPATCH_QUEUES];
 };
 
 enum FF_KNICTL_CMD {
@@ -125,6 +152,117 @@ struct ff_knictl_args {
     int kni_action;
 };
 
+enum FF_PCAP_CMD {
+    FF_PCAP_CMD_START,
+    FF_PCAP_CMD_STOP,
+    FF_PCAP_CMD_STATUS,
+};
+
+#define FF_PCAP_DIR_IN  0x1
+#define FF_PCAP_DIR_OUT 0x2
+
+struct ebpf_insn;
+
+struct ff_pcap_args {
+    int cmd;
+
+    /* FF_PCAP_DIR_* */
+    int direction;
+    /* 0 for the [pcap] snaplen */
+    uint16_t snap_len;
+    /* stop after capturing these packets, 0 for no limit */
+    uint64_t max_pkts;
+    /*
+     * Optional filter run on every packet before it is copied: a pcap
+     * filter converted to eBPF by rte_bpf_convert(), in the msg buffer.
+     */
+    struct ebpf_insn *filter;
+    uint32_t filter_len;
+
+    /* status, returned for every cmd */
+    int running;
+    uint64_t captured;
+    uint64_t filtered;
+    uint64_t drops;
+};
+
+/* What the latency histograms measure, in tsc cycles */
+enum FF_LATENCY_TYPE {
+    FF_LATENCY_LOOP = 0,    /* main loop iteration, idle sleep excluded */
+    FF_LATENCY_TIMER,       /* rte_timer_manage(), the stack's clock */
+    FF_LATENCY_RX,          /* rx burst received until the stack handled it */
+    FF_LATENCY_USER,        /* user loop callback */
+    FF_LATENCY_DISPATCH,    /* packet dispatcher */
+    FF_LATENCY_NUM,
+};
+
+/*
+ * Log-linear buckets: values below FF_LATENCY_SUB are exact, every power
+ * of two above is split in FF_LATENCY_SUB linear buckets, so a bucket is
+ * at most 1/16 of its value wide. Values of 2^FF_LATENCY_MAX_BITS cycles
+ * and more all land in the last bucket.
+ */
+#define FF_LATENCY_SUB_BITS 4
+#define FF_LATENCY_SUB      (1 << FF_LATENCY_SUB_BITS)
+#define FF_LATENCY_MAX_BITS 40
+#define FF_LATENCY_BUCKETS  \
+    ((FF_LATENCY_MAX_BITS - FF_LATENCY_SUB_BITS + 1) * FF_LATENCY_SUB)
+
+struct ff_latency_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[FF_LATENCY_BUCKETS];
+};
+
+static inline unsigned
+ff_latency_bucket(uint64_t v)
+{
+    unsigned m;
+
+    if (v < FF_LATENCY_SUB)
+        return v;
+
+    m = 63 - __builtin_clzll(v);
+    if (m >= FF_LATENCY_MAX_BITS)
+        return FF_LATENCY_BUCKETS - 1;
+
+    return ((m - FF_LATENCY_SUB_BITS + 1) << FF_LATENCY_SUB_BITS) +
+        ((v >> (m - FF_LATENCY_SUB_BITS)) & (FF_LATENCY_SUB - 1));
+}
+
+/* Smallest value of a bucket */
+static inline uint64_t
+ff_latency_bucket_low(unsigned b)
+{
+    unsigned g = b >> FF_LATENCY_SUB_BITS;
+    uint64_t sub = b & (FF_LATENCY_SUB - 1);
+
+    if (g == 0)
+        return sub;
+
+    return (FF_LATENCY_SUB + sub) << (g - 1);
+}
+
+enum FF_LATENCY_CMD {
+    FF_LATENCY_CMD_GET,
+    FF_LATENCY_CMD_RESET,
+};
+
+struct ff_latency_args {
+    int cmd;
+    /* GET: the histogram to copy, RESET: the one to clear, -1 for all */
+    int type;
+    /* GET: clear the histogram once copied */
+    int reset;
+
+    /* returned for every cmd */
+    int enabled;
+    uint64_t tsc_hz;
+    /* GET: the copy, in the msg buffer */
+    struct ff_latency_hist *hist;
+};
+
 
 #define MAX_MSG_BUF_SIZE 10240
 
@@ -133,6 +271,12 @@ struct ff_msg {
     enum FF_MSG_TYPE msg_type;
     /* Result of msg processing */
     int result;
+    /* enum FF_MSG_STATE, shared by requester and owning process */
+    uint32_t state;
+    /* keep the members below 8 byte aligned */
+    uint32_t reserved;
+    /* tsc when the requester sent it */
+    uint64_t send_tsc;
     /* Length of segment buffer. */
     size_t buf_len;
     /* Address of segment buffer. */
@@ -149,7 +293,16 @@ struct ff_msg {
         struct ff_ipfw_args ipfw;
         struct ff_traffic_args traffic;
         struct ff_knictl_args knictl;
+        struct ff_pcap_args pcap;
+        struct ff_latency_args latency;
     };
 } __attribute__((packed)) __rte_cache_aligned;
 
+/* The futex word, state sits at a 4 byte aligned offset of a packed msg */
+static inline uint32_t *
+ff_msg_state(struct ff_msg *msg)
+{
+    return (uint32_t *)((char *)msg + offsetof(struct ff_msg, state));
+}
+
 #endif
@@ -34,6 +34,7 @@
 #include <sys/module.h>
 #include <sys/param.h>
 #include <sys/malloc.h>
+#include <sys/mbuf.h>
 #include <sys/socketvar.h>
 #include <sys/event.h>
 #include <sys/kernel.h>
@@ -44,6 +45,7 @@
 #include <sys/poll.h>
 #include <sys/event.h>
 #include <sys/file.h>
+#include <sys/capsicum.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/ttycom.h>
@@ -199,6 +201,13 @@ struct linux_msghdr {
     int msg_flags;              /* Flags on received message.  */
 };
 
+struct linux_mmsghdr {
+    struct linux_msghdr msg_hdr;
+    unsigned int msg_len;       /* Number of bytes transmitted.  */
+};
+
+#define LINUX_MSG_WAITFORONE 0x10000
+
 /* msghdr define end */
 
 /* cmsghdr define start */
@@ -547,8 +556,9 @@ linux2freebsd_cmsg(const struct msghdr *msg, struct cmsghdr **cmsg)
         memcpy(((char *)cmsg_bsd)+sizeof(struct cmsghdr), ((char *)linux_cmsg)+sizeof(struct linux_cmsghdr), linux_cmsg->cmsg_len - sizeof(struct linux_cmsghdr));
         cmsg_bsd->cmsg_type = linux2freebsd_opt(cmsg_bsd->cmsg_level, cmsg_bsd->cmsg_type, CMSG_DATA(cmsg_bsd), cmsg_bsd->cmsg_len - CMSG_ALIGN(sizeof(struct cmsghdr)), &modoptval, &modoptlen);
         if (cmsg_bsd->cmsg_type < 0) {
-            free(cmsg,NULL);
-            return -1;        
+            free(*cmsg,NULL);
+            *cmsg = NULL;
+            return -1;
         }
         cmsg_bsd->cmsg_len = modoptlen;
         linux_cmsg = (struct linux_cmsghdr*) CMSG_NXTHDR(msg, linux_cmsg);
@@ -826,6 +836,72 @@ kern_fail:
     return (-1);
 }
 
+/*
+ * Transfer on a vector of descriptors in one call, a failed entry
+ * doesn't stop the ones after it.
+ */
+int
+ff_readv_batch(struct ff_iovec_batch *vec, int n)
+{
+    struct ff_iovec_batch *b;
+    struct uio auio;
+    int i, j, rc, done;
+
+    done = 0;
+    for (i = 0; i < n; i++) {
+        b = &vec[i];
+        auio.uio_iov = __DECONST(struct iovec *, b->iov);
+        auio.uio_iovcnt = b->iovcnt;
+        auio.uio_resid = 0;
+        auio.uio_segflg = UIO_SYSSPACE;
+        for (j = 0; j < b->iovcnt; j++)
+            auio.uio_resid += b->iov[j].iov_len;
+
+        if ((rc = kern_readv(curthread, b->fd, &auio))) {
+            ff_os_errno(rc);
+            b->ret = -1;
+            b->error = ff_os_get_errno();
+            continue;
+        }
+        b->ret = curthread->td_retval[0];
+        b->error = 0;
+        done++;
+    }
+
+    return (done);
+}
+
+int
+ff_writev_batch(struct ff_iovec_batch *vec, int n)
+{
+    struct ff_iovec_batch *b;
+    struct uio auio;
+    int i, j, rc, done;
+
+    done = 0;
+    for (i = 0; i < n; i++) {
+        b = &vec[i];
+        auio.uio_iov = __DECONST(struct iovec *, b->iov);
+        auio.uio_iovcnt = b->iovcnt;
+        auio.uio_resid = 0;
+        auio.uio_segflg = UIO_SYSSPACE;
+        for (j = 0; j < b->iovcnt; j++)
+            auio.uio_resid += b->iov[j].iov_len;
+
+        if ((rc = kern_writev(curthread, b->fd, &auio))) {
+            ff_os_errno(rc);
+            b->ret = -1;
+            b->error = ff_os_get_errno();
+            continue;
+        }
+        b->ret = curthread->td_retval[0];
+        b->error = 0;
+        done++;
+    }
+
+    return (done);
+}
+
 ssize_t
 ff_send(int s, const void *buf, size_t len, int flags)
 {
@@ -983,6 +1059,321 @@ kern_fail:
     return (-1);
 }
 
+/*
+ * Set up the uio of one message of a ff_sendmmsg()/ff_recvmmsg() vector.
+ */
+static int
+ff_mmsg_uio(struct linux_msghdr *linux_msg, struct uio *auio,
+    enum uio_rw rw)
+{
+    int i;
+
+    if (linux_msg->msg_iovlen > UIO_MAXIOV)
+        return (EMSGSIZE);
+
+    auio->uio_iov = linux_msg->msg_iov;
+    auio->uio_iovcnt = linux_msg->msg_iovlen;
+    auio->uio_segflg = UIO_SYSSPACE;
+    auio->uio_rw = rw;
+    auio->uio_td = curthread;
+    auio->uio_offset = 0;
+    auio->uio_resid = 0;
+    for (i = 0; i < auio->uio_iovcnt; i++) {
+        if ((auio->uio_resid += auio->uio_iov[i].iov_len) < 0)
+            return (EINVAL);
+    }
+
+    return (0);
+}
+
+/*
+ * Control mbuf of one message to send, as sockargs() builds it for sendit().
+ */
+static int
+ff_mmsg_control(struct linux_msghdr *linux_msg, struct mbuf **controlp)
+{
+    struct cmsghdr *cmsg;
+    struct mbuf *control;
+    size_t len = linux_msg->msg_controllen;
+
+    *controlp = NULL;
+    if (linux_msg->msg_control == NULL)
+        return (0);
+
+    if (len < sizeof(struct cmsghdr) || len > MJUMPAGESIZE)
+        return (EINVAL);
+
+    if (linux2freebsd_cmsg((struct msghdr *)linux_msg, &cmsg) < 0)
+        return (EINVAL);
+
+    control = m_get2(len, M_WAITOK, MT_CONTROL, 0);
+    control->m_len = len;
+    bcopy(cmsg, mtod(control, void *), len);
+    free(cmsg, NULL);
+    *controlp = control;
+
+    return (0);
+}
+
+/*
+ * Send a vector of messages on one socket, which is looked up and
+ * referenced once for the whole batch.
+ * Same as Linux, the number of messages sent is returned, an error
+ * is only reported if the first message can't be sent.
+ */
+int
+ff_sendmmsg(int s, struct ff_mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+    struct linux_mmsghdr *mmsg = (struct linux_mmsghdr *)msgvec;
+    struct linux_msghdr *linux_msg;
+    struct sockaddr_storage freebsd_sa;
+    struct sockaddr *to;
+    struct mbuf *control;
+    struct file *fp;
+    struct socket *so;
+    struct uio auio;
+    unsigned int i;
+    ssize_t len;
+    int rc;
+
+    if (msgvec == NULL) {
+        rc = EFAULT;
+        goto kern_fail;
+    }
+    if (vlen > UIO_MAXIOV)
+        vlen = UIO_MAXIOV;
+
+    rc = getsock_cap(curthread, s, &cap_send_connect_rights, &fp, NULL, NULL);
+    if (rc)
+        goto kern_fail;
+    so = fp->f_data;
+
+    for (i = 0; i < vlen; i++) {
+        linux_msg = &mmsg[i].msg_hdr;
+
+        to = NULL;
+        if (linux_msg->msg_name != NULL) {
+            if (linux_msg->msg_namelen < offsetof(struct sockaddr, sa_data) ||
+                linux_msg->msg_namelen > sizeof(freebsd_sa)) {
+                rc = EINVAL;
+                break;
+            }
+            to = (struct sockaddr *)&freebsd_sa;
+            linux2freebsd_sockaddr(linux_msg->msg_name,
+                linux_msg->msg_namelen, to);
+        }
+
+        if ((rc = ff_mmsg_uio(linux_msg, &auio, UIO_WRITE)))
+            break;
+        if ((rc = ff_mmsg_control(linux_msg, &control)))
+            break;
+
+        len = auio.uio_resid;
+        rc = sosend(so, to, &auio, NULL, control, flags, curthread);
+        if (rc && auio.uio_resid != len &&
+            (rc == ERESTART || rc == EINTR || rc == EWOULDBLOCK))
+            rc = 0;
+        if (rc)
+            break;
+
+        mmsg[i].msg_len = len - auio.uio_resid;
+    }
+
+    fdrop(fp, curthread);
+
+    if (i == 0 && rc)
+        goto kern_fail;
+
+    return (i);
+kern_fail:
+    ff_os_errno(rc);
+    return (-1);
+}
+
+/*
+ * Receive a vector of messages from one socket, which is looked up and
+ * referenced once for the whole batch.
+ * Same as Linux, with MSG_WAITFORONE only the first message may block,
+ * and `timeout` is checked after each message received, it's updated
+ * with the time left on return.
+ */
+int
+ff_recvmmsg(int s, struct ff_mmsghdr *msgvec, unsigned int vlen, int flags,
+    struct timespec *timeout)
+{
+    struct linux_mmsghdr *mmsg = (struct linux_mmsghdr *)msgvec;
+    struct linux_msghdr *linux_msg;
+    struct sockaddr_storage linux_sa;
+    struct sockaddr *fromsa;
+    struct mbuf *control, *m;
+    struct timespec end, now;
+    struct file *fp;
+    struct socket *so;
+    struct uio auio;
+    unsigned int i;
+    ssize_t len;
+    size_t ctllen;
+    caddr_t ctlbuf;
+    int rc, msgflags, waitforone;
+
+    if (msgvec == NULL) {
+        rc = EFAULT;
+        goto kern_fail;
+    }
+    if (timeout != NULL && (timeout->tv_sec < 0 ||
+        timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000)) {
+        rc = EINVAL;
+        goto kern_fail;
+    }
+    if (vlen > UIO_MAXIOV)
+        vlen = UIO_MAXIOV;
+
+    waitforone = flags & (LINUX_MSG_WAITFORONE | MSG_WAITFORONE);
+    flags &= ~(LINUX_MSG_WAITFORONE | MSG_WAITFORONE);
+
+    if (timeout != NULL) {
+        getnanouptime(&end);
+        timespecadd(&end, timeout, &end);
+    }
+
+    rc = getsock_cap(curthread, s, &cap_recv_rights, &fp, NULL, NULL);
+    if (rc)
+        goto kern_fail;
+    so = fp->f_data;
+
+    for (i = 0; i < vlen; i++) {
+        if (timeout != NULL && i > 0) {
+            getnanouptime(&now);
+            if (timespeccmp(&now, &end, >=))
+                break;
+        }
+
+        linux_msg = &mmsg[i].msg_hdr;
+        if ((rc = ff_mmsg_uio(linux_msg, &auio, UIO_READ)))
+            break;
+
+        fromsa = NULL;
+        control = NULL;
+        msgflags = flags;
+        len = auio.uio_resid;
+        rc = soreceive(so, linux_msg->msg_name ? &fromsa : NULL, &auio,
+            NULL, linux_msg->msg_control ? &control : NULL, &msgflags);
+        if (rc && auio.uio_resid != len &&
+            (rc == ERESTART || rc == EINTR || rc == EWOULDBLOCK))
+            rc = 0;
+        if (rc) {
+            free(fromsa, M_SONAME);
+            m_freem(control);
+            break;
+        }
+
+        mmsg[i].msg_len = len - auio.uio_resid;
+        linux_msg->msg_flags = msgflags;
+
+        if (linux_msg->msg_name != NULL) {
+            if (fromsa == NULL) {
+                linux_msg->msg_namelen = 0;
+            } else {
+                freebsd2linux_sockaddr((struct linux_sockaddr *)&linux_sa,
+                    fromsa);
+                linux_msg->msg_namelen = MIN(linux_msg->msg_namelen,
+                    fromsa->sa_len);
+                bcopy(&linux_sa, linux_msg->msg_name,
+                    linux_msg->msg_namelen);
+                free(fromsa, M_SONAME);
+            }
+        }
+
+        if (linux_msg->msg_control != NULL) {
+            ctlbuf = linux_msg->msg_control;
+            ctllen = linux_msg->msg_controllen;
+            linux_msg->msg_controllen = 0;
+            for (m = control; m != NULL && ctllen >= m->m_len; m = m->m_next) {
+                bcopy(mtod(m, caddr_t), ctlbuf, m->m_len);
+                ctlbuf += m->m_len;
+                ctllen -= m->m_len;
+                linux_msg->msg_controllen += m->m_len;
+            }
+            if (m != NULL)
+                linux_msg->msg_flags |= MSG_CTRUNC;
+            if (linux_msg->msg_controllen)
+                freebsd2linux_cmsghdr(linux_msg);
+            m_freem(control);
+        }
+
+        if (waitforone)
+            flags |= MSG_DONTWAIT;
+    }
+
+    fdrop(fp, curthread);
+
+    if (timeout != NULL) {
+        getnanouptime(&now);
+        if (timespeccmp(&end, &now, >))
+            timespecsub(&end, &now, timeout);
+        else
+            timeout->tv_sec = timeout->tv_nsec = 0;
+    }
+
+    if (i == 0 && rc)
+        goto kern_fail;
+
+    return (i);
+kern_fail:
+    ff_os_errno(rc);
+    return (-1);
+}
+
+/*
+ * Receive without copying, the data is handed over as the mbuf chain
+ * taken out of the socket buffer, see ff_zc_mbuf_read().
+ */
+ssize_t
+ff_zc_recv(int s, struct ff_zc_mbuf *m, size_t len, int flags)
+{
+    struct file *fp;
+    struct socket *so;
+    struct uio auio;
+    struct mbuf *mb = NULL;
+    int rc;
+
+    if (m == NULL || len > INT_MAX) {
+        rc = EINVAL;
+        goto kern_fail;
+    }
+
+    rc = getsock_cap(curthread, s, &cap_recv_rights, &fp, NULL, NULL);
+    if (rc)
+        goto kern_fail;
+    so = fp->f_data;
+
+    bzero(&auio, sizeof(auio));
+    auio.uio_resid = len;
+    auio.uio_segflg = UIO_SYSSPACE;
+    auio.uio_rw = UIO_READ;
+    auio.uio_td = curthread;
+
+    rc = soreceive(so, NULL, &auio, &mb, NULL, &flags);
+    fdrop(fp, curthread);
+
+    if (rc && auio.uio_resid != len &&
+        (rc == ERESTART || rc == EINTR || rc == EWOULDBLOCK))
+        rc = 0;
+    if (rc) {
+        m_freem(mb);
+        goto kern_fail;
+    }
+
+    m->bsd_mbuf = m->bsd_mbuf_off = mb;
+    m->off = 0;
+    m->len = len - auio.uio_resid;
+
+    return (m->len);
+kern_fail:
+    ff_os_errno(rc);
+    return (-1);
+}
+
 int
 ff_fcntl(int fd, int cmd, ...)
 {
@@ -1199,6 +1590,10 @@ ff_poll(struct pollfd fds[], nfds_t nfds, int timeout)
     if ((rc = kern_poll(curthread, fds, nfds, &ts, NULL)))
         goto kern_fail;
     rc = curthread->td_retval[0];
+
+    if (rc == 0 && timeout != 0)
+        ff_loop_wait(timeout < 0 ? -1 : (int64_t)timeout * 1000000);
+
     return (rc);
 
 kern_fail:
@@ -1300,6 +1695,19 @@ ff_kevent_do_each(int kq, const struct kevent *changelist, int nchanges,
         goto kern_fail;
 
     rc = curthread->td_retval[0];
+
+    /*
+     * The scan itself never blocks, an empty one hands its timeout
+     * over to the main loop, see ff_loop_wait().
+     */
+    if (rc == 0 && nevents > 0) {
+        if (timeout == NULL)
+            ff_loop_wait(-1);
+        else if (timeout->tv_sec != 0 || timeout->tv_nsec != 0)
+            ff_loop_wait((int64_t)timeout->tv_sec * 1000000000 +
+                timeout->tv_nsec);
+    }
+
     return (rc);
 kern_fail:
     ff_os_errno(rc);
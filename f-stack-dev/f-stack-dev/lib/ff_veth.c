@@ -39,6 +39,7 @@
 #include <sys/kthread.h>
 #include <sys/sched.h>
 #include <sys/sockio.h>
+#include <sys/sysctl.h>
 #include <sys/ck.h>
 
 #include <net/if.h>
@@ -53,6 +54,7 @@
 
 #include <netinet/in.h>
 #include <netinet/in_var.h>
+#include <netinet/tcp_lro.h>
 #include <netinet6/nd6.h>
 
 #include <machine/atomic.h>
@@ -85,8 +87,15 @@ struct ff_veth_softc {
 #endif /* INET6 */
 
     struct ff_dpdk_if_context *host_ctx;
+
+    /* software LRO, see ff_veth_setup_lro() */
+    int lro_enabled;
+    struct lro_ctrl lro;
+    struct sysctl_ctx_list lro_sysctl_ctx;
 };
 
+SYSCTL_DECL(_net_inet_tcp_lro);
+
 static int
 ff_veth_config(struct ff_veth_softc *sc, struct ff_port_cfg *cfg)
 {
@@ -212,11 +221,11 @@ ff_mbuf_tx_offload(void *m, struct ff_tx_offload *offload)
         offload->ip_csum = 1;
     }
 
-    if (mb->m_pkthdr.csum_flags & CSUM_TCP) {
+    if (mb->m_pkthdr.csum_flags & (CSUM_TCP | CSUM_TCP_IPV6)) {
         offload->tcp_csum = 1;
     }
 
-    if (mb->m_pkthdr.csum_flags & CSUM_UDP) {
+    if (mb->m_pkthdr.csum_flags & (CSUM_UDP | CSUM_UDP_IPV6)) {
         offload->udp_csum = 1;
     }
 
@@ -294,10 +303,47 @@ ff_zc_mbuf_write(struct ff_zc_mbuf *zm, const char *data, int len)
 }
 
 int
-ff_zc_mbuf_read(struct ff_zc_mbuf *m, const char *data, int len)
+ff_zc_mbuf_read(struct ff_zc_mbuf *zm, const char **data, int len)
 {
-    // DOTO: Support read zero copy
-    return 0;
+    struct mbuf *mb;
+    int length;
+
+    if (zm == NULL || data == NULL || len <= 0) {
+        return -1;
+    }
+
+    mb = (struct mbuf *)zm->bsd_mbuf_off;
+    while (mb != NULL && mb->m_len == 0) {
+        mb = mb->m_next;
+    }
+
+    if (mb == NULL) {
+        zm->bsd_mbuf_off = NULL;
+        return 0;
+    }
+
+    /* consume from the front of the mbuf, it belongs to the APP now */
+    length = min(mb->m_len, len);
+    *data = mtod(mb, const char *);
+    mb->m_data += length;
+    mb->m_len -= length;
+
+    zm->off += length;
+    zm->bsd_mbuf_off = mb->m_len ? mb : mb->m_next;
+
+    return length;
+}
+
+void
+ff_zc_mbuf_free(struct ff_zc_mbuf *zm)
+{
+    if (zm == NULL) {
+        return;
+    }
+
+    m_freem((struct mbuf *)zm->bsd_mbuf);
+    zm->bsd_mbuf = zm->bsd_mbuf_off = NULL;
+    zm->off = zm->len = 0;
 }
 
 void *
@@ -351,6 +397,33 @@ ff_mbuf_get(void *p, void *m, void *data, uint16_t len)
     return (void *)mb;
 }
 
+/*
+ * Copy the packet into mbufs of the stack instead of attaching its buffer,
+ * for rte_mbufs whose data is shared with other queues: the stack may
+ * rewrite a packet in place, arpinput() turns a request into the reply.
+ */
+void *
+ff_mbuf_devget(void *data, uint16_t len, uint8_t rx_csum)
+{
+    struct mbuf *m = m_devget(data, len, 0, NULL, NULL);
+    if (m == NULL) {
+        return NULL;
+    }
+
+    if (rx_csum) {
+        m->m_pkthdr.csum_flags = CSUM_IP_CHECKED | CSUM_IP_VALID |
+            CSUM_DATA_VALID | CSUM_PSEUDO_HDR;
+        m->m_pkthdr.csum_data = 0xffff;
+    }
+    return (void *)m;
+}
+
+int
+ff_mbuf_append(void *hdr, void *data, uint16_t len)
+{
+    return m_append((struct mbuf *)hdr, len, data);
+}
+
 void
 ff_veth_process_packet(void *arg, void *m)
 {
@@ -362,6 +435,47 @@ ff_veth_process_packet(void *arg, void *m)
     ifp->if_input(ifp, mb);
 }
 
+/*
+ * Hand a whole rx burst to the stack in one if_input call,
+ * ether_input() walks the m_nextpkt chain itself.
+ * With software LRO enabled, in-order TCP segments of the same flow
+ * are coalesced first and flushed to the stack at the end of the burst.
+ */
+void
+ff_veth_process_packets(void *arg, void **m, int count)
+{
+    struct ifnet *ifp = (struct ifnet *)arg;
+    struct ff_veth_softc *sc = (struct ff_veth_softc *)ifp->if_softc;
+    struct mbuf *head = NULL, *tail = NULL, *mb;
+    int i, lro = sc->lro_enabled && (ifp->if_capenable & IFCAP_LRO);
+
+    for (i = 0; i < count; i++) {
+        mb = (struct mbuf *)m[i];
+        mb->m_pkthdr.rcvif = ifp;
+        mb->m_nextpkt = NULL;
+
+        if (lro && (mb->m_pkthdr.csum_flags & CSUM_DATA_VALID) &&
+            tcp_lro_rx(&sc->lro, mb, 0) == 0) {
+            continue;
+        }
+
+        if (tail != NULL) {
+            tail->m_nextpkt = mb;
+        } else {
+            head = mb;
+        }
+        tail = mb;
+    }
+
+    if (head != NULL) {
+        ifp->if_input(ifp, head);
+    }
+
+    if (lro) {
+        tcp_lro_flush_all(&sc->lro);
+    }
+}
+
 static int
 ff_veth_transmit(struct ifnet *ifp, struct mbuf *m)
 {
@@ -589,6 +703,57 @@ done:
 }
 #endif /* INET6 */
 
+static void
+ff_veth_setup_lro(struct ff_veth_softc *sc, struct ff_port_cfg *cfg)
+{
+    struct sysctl_oid *oid;
+    int error;
+
+    if (ff_global_cfg.dpdk.soft_lro == 0) {
+        return;
+    }
+
+    /*
+     * Coalesced segments are passed up as checksum verified,
+     * so only do it when the NIC has already checked them.
+     */
+    if (!cfg->hw_features.rx_csum) {
+        printf("%s: software LRO needs RX checksum offload, disabled\n",
+            sc->host_ifname);
+        return;
+    }
+
+    error = tcp_lro_init_args(&sc->lro, sc->ifp,
+        ff_global_cfg.dpdk.soft_lro_entries, 0);
+    if (error != 0) {
+        printf("%s: tcp_lro_init_args failed: %d\n", sc->host_ifname, error);
+        return;
+    }
+
+    sc->ifp->if_capabilities |= IFCAP_LRO;
+    sc->lro_enabled = 1;
+
+    sysctl_ctx_init(&sc->lro_sysctl_ctx);
+    oid = SYSCTL_ADD_NODE(&sc->lro_sysctl_ctx,
+        SYSCTL_STATIC_CHILDREN(_net_inet_tcp_lro), OID_AUTO, sc->host_ifname,
+        CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, "Software LRO statistics");
+    if (oid == NULL) {
+        return;
+    }
+    SYSCTL_ADD_U64(&sc->lro_sysctl_ctx, SYSCTL_CHILDREN(oid), OID_AUTO,
+        "queued", CTLFLAG_RD, &sc->lro.lro_queued, 0,
+        "Segments passed to the stack");
+    SYSCTL_ADD_U64(&sc->lro_sysctl_ctx, SYSCTL_CHILDREN(oid), OID_AUTO,
+        "flushed", CTLFLAG_RD, &sc->lro.lro_flushed, 0,
+        "Coalesced packets passed to the stack");
+    SYSCTL_ADD_U64(&sc->lro_sysctl_ctx, SYSCTL_CHILDREN(oid), OID_AUTO,
+        "bad_csum", CTLFLAG_RD, &sc->lro.lro_bad_csum, 0,
+        "Segments with bad ip header checksum");
+
+    printf("%s: software LRO enabled, %u entries\n", sc->host_ifname,
+        ff_global_cfg.dpdk.soft_lro_entries);
+}
+
 static int
 ff_veth_setup_interface(struct ff_veth_softc *sc, struct ff_port_cfg *cfg)
 {
@@ -607,6 +772,10 @@ ff_veth_setup_interface(struct ff_veth_softc *sc, struct ff_port_cfg *cfg)
     ifp->if_qflush = ff_veth_qflush;
     ether_ifattach(ifp, sc->mac);
 
+    if (cfg->mtu) {
+        ifp->if_mtu = cfg->mtu;
+    }
+
     if (cfg->hw_features.rx_csum) {
         ifp->if_capabilities |= IFCAP_RXCSUM;
     }
@@ -616,11 +785,21 @@ ff_veth_setup_interface(struct ff_veth_softc *sc, struct ff_port_cfg *cfg)
     }
     if (cfg->hw_features.tx_csum_l4) {
         ifp->if_hwassist |= CSUM_DELAY_DATA;
+#ifdef INET6
+        ifp->if_capabilities |= IFCAP_TXCSUM_IPV6;
+        ifp->if_hwassist |= CSUM_DELAY_DATA_IPV6;
+#endif
     }
     if (cfg->hw_features.tx_tso) {
         ifp->if_capabilities |= IFCAP_TSO;
         ifp->if_hwassist |= CSUM_TSO;
     }
+    if (cfg->hw_features.tx_soft_tso) {
+        ifp->if_capabilities |= IFCAP_TSO4;
+        ifp->if_hwassist |= CSUM_IP_TSO;
+    }
+
+    ff_veth_setup_lro(sc, cfg);
 
     ifp->if_capenable = ifp->if_capabilities;
 
@@ -714,6 +893,10 @@ ff_veth_detach(void *arg)
 {
     struct ff_veth_softc *sc = (struct ff_veth_softc *)arg;
     if (sc) {
+        if (sc->lro_enabled) {
+            sysctl_ctx_free(&sc->lro_sysctl_ctx);
+            tcp_lro_free(&sc->lro);
+        }
         ff_dpdk_deregister_if(sc->host_ctx);
         free(sc, M_DEVBUF);
     }
@@ -34,6 +34,8 @@ int ff_veth_detach(void *arg);
 void *ff_mbuf_gethdr(void *pkt, uint16_t total, void *data,
     uint16_t len, uint8_t rx_csum);
 void *ff_mbuf_get(void *p, void *m, void *data, uint16_t len);
+void *ff_mbuf_devget(void *data, uint16_t len, uint8_t rx_csum);
+int ff_mbuf_append(void *hdr, void *data, uint16_t len);
 void ff_mbuf_free(void *m);
 
 int ff_mbuf_copydata(void *m, void *data, int off, int len);
@@ -45,6 +47,7 @@ struct ff_tx_offload;
 void ff_mbuf_tx_offload(void *m, struct ff_tx_offload *offload);
 
 void ff_veth_process_packet(void *arg, void *m);
+void ff_veth_process_packets(void *arg, void **m, int count);
 
 void *ff_veth_softc_to_hostc(void *softc);
 
@@ -54,6 +54,8 @@
 
 extern int uma_page_mask;
 
+void *ff_malloc(uint64_t size);
+
 extern int __read_mostly vm_ndomains;
 
 #define UMA_PAGE_HASH(va) (((va) >> PAGE_SHIFT) & uma_page_mask)
@@ -92,6 +94,12 @@ vtozoneslab(vm_offset_t va, uma_zone_t *zone, uma_slab_t *slab)
         if (up->up_va == (va & (~(PAGE_SIZE - 1))))
             break;
 
+    if (up == NULL) {
+        *slab = NULL;
+        *zone = NULL;
+        return;
+    }
+
     *slab = up->up_slab;
     *zone = up->up_zone;
 }
@@ -112,7 +120,8 @@ vsetzoneslab(vm_offset_t va, uma_zone_t zone, uma_slab_t slab)
         return;
     }
 
-    up = malloc(sizeof(*up), M_DEVBUF, M_WAITOK);
+    /* not malloc(9), its zones find their slabs here */
+    up = ff_malloc(sizeof(*up));
     up->up_va = va;
     up->up_slab = slab;
     up->up_zone = zone;
@@ -31,14 +31,42 @@
 #include <rte_ring.h>
 #include <rte_mempool.h>
 #include <rte_malloc.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
 #include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "ff_ipc.h"
 
+/* Requests of one type that may be in flight at the same time */
+#define FF_IPC_MAX_INFLIGHT 1024
+
+/* Spin this long for a reply before sleeping on the futex */
+#define FF_IPC_SPIN_US      50
+
+/* Give up on a reply after this long */
+#define FF_IPC_TIMEOUT_US   1000000
+
 static int inited;
 
 static struct rte_mempool *message_pool;
 
+/* Sent but not yet received requests, per msg type, in send order */
+static struct {
+    unsigned head;
+    unsigned tail;
+    struct ff_msg *msgs[FF_IPC_MAX_INFLIGHT];
+} inflight[FF_MSG_NUM];
+
+/*
+ * Timed out requests handed over to their owning process, which puts them
+ * back in the pool whenever it completes them; ff_ipc_msg_free() must not.
+ * Kept here as the message itself may already be reused by then.
+ */
+static struct ff_msg *abandoned[FF_IPC_MAX_INFLIGHT];
+static unsigned nb_abandoned;
+
 uint16_t ff_proc_id = 0;
 
 void
@@ -109,11 +137,21 @@ ff_ipc_msg_alloc(void)
 int
 ff_ipc_msg_free(struct ff_msg *msg)
 {
+    unsigned i;
+
     if (inited == 0) {
         printf("ff ipc not inited\n");
         return -1;
     }
 
+    /* a timed out request is freed by the process that owns it */
+    for (i = 0; i < nb_abandoned; i++) {
+        if (abandoned[i] == msg) {
+            abandoned[i] = abandoned[--nb_abandoned];
+            return 0;
+        }
+    }
+
     if (msg->original_buf) {
         rte_free(msg->buf_addr);
         msg->buf_addr = msg->original_buf;
@@ -127,9 +165,10 @@ ff_ipc_msg_free(struct ff_msg *msg)
 }
 
 int
-ff_ipc_send(const struct ff_msg *msg)
+ff_ipc_send(struct ff_msg *msg)
 {
     int ret;
+    unsigned type;
 
     if (inited == 0) {
         printf("ff ipc not inited\n");
@@ -145,44 +184,107 @@ ff_ipc_send(const struct ff_msg *msg)
         return -1;
     }
 
+    type = msg->msg_type;
+    if (type >= FF_MSG_NUM ||
+        inflight[type].tail - inflight[type].head == FF_IPC_MAX_INFLIGHT) {
+        printf("ff_ipc_send failed, too many requests in flight\n");
+        return -1;
+    }
+
+    msg->state = FF_MSG_PENDING;
+    msg->send_tsc = rte_rdtsc();
     ret = rte_ring_enqueue(ring, (void *)msg);
     if (ret < 0) {
+        msg->state = FF_MSG_DONE;
         printf("ff_ipc_send failed\n");
         return ret;
     }
 
+    inflight[type].msgs[inflight[type].tail++ % FF_IPC_MAX_INFLIGHT] = msg;
+
     return 0;
 }
 
+/*
+ * Wait for the owning process to complete msg. Most replies arrive within
+ * one main loop iteration, so spin briefly before sleeping on the futex;
+ * the owning process only makes the wake syscall once we are asleep.
+ */
+static int
+ff_ipc_wait(struct ff_msg *msg)
+{
+    uint64_t hz = rte_get_timer_hz();
+    uint64_t start = rte_get_timer_cycles();
+    uint64_t spin = hz * FF_IPC_SPIN_US / US_PER_S;
+    uint64_t timeout = hz * FF_IPC_TIMEOUT_US / US_PER_S;
+    uint64_t elapsed, left;
+    uint32_t *word = ff_msg_state(msg);
+    uint32_t state;
+    struct timespec ts;
+
+    for (;;) {
+        state = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        if (state == FF_MSG_DONE) {
+            return 0;
+        }
+
+        elapsed = rte_get_timer_cycles() - start;
+        if (elapsed < spin) {
+            rte_pause();
+            continue;
+        }
+
+        /*
+         * hand it over, unless it completed meanwhile; with no room left
+         * to remember it keep waiting rather than risk freeing it twice
+         */
+        if (elapsed >= timeout && nb_abandoned < FF_IPC_MAX_INFLIGHT) {
+            if (__atomic_compare_exchange_n(word, &state,
+                FF_MSG_ABANDONED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                abandoned[nb_abandoned++] = msg;
+                return -1;
+            }
+            continue;
+        }
+
+        if (state == FF_MSG_PENDING &&
+            !__atomic_compare_exchange_n(word, &state,
+            FF_MSG_WAITING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        left = elapsed < timeout ? timeout - elapsed : timeout;
+        left = left * US_PER_S / hz;
+        ts.tv_sec = left / US_PER_S;
+        ts.tv_nsec = (left % US_PER_S) * 1000;
+        syscall(SYS_futex, word, FUTEX_WAIT, FF_MSG_WAITING,
+            &ts, NULL, 0);
+    }
+}
+
 int
 ff_ipc_recv(struct ff_msg **msg, enum FF_MSG_TYPE msg_type)
 {
-    int ret, i;
+    struct ff_msg *m;
+
     if (inited == 0) {
         printf("ff ipc not inited\n");
         return -1;
     }
 
-    char name[RTE_RING_NAMESIZE];
-    snprintf(name, RTE_RING_NAMESIZE, "%s%u_%u",
-        FF_MSG_RING_OUT, ff_proc_id, msg_type);
-    struct rte_ring *ring = rte_ring_lookup(name);
-    if (ring == NULL) {
-        printf("lookup message ring:%s failed!\n", name);
+    if (msg_type >= FF_MSG_NUM ||
+        inflight[msg_type].head == inflight[msg_type].tail) {
+        printf("ff_ipc_recv failed, no request in flight\n");
         return -1;
     }
 
-    void *obj;
-    #define MAX_ATTEMPTS_NUM 1000
-    for (i = 0; i < MAX_ATTEMPTS_NUM; i++) {
-        ret = rte_ring_dequeue(ring, &obj);
-        if (ret == 0) {
-            *msg = (struct ff_msg *)obj;
-            break;
-        }
-
-        usleep(1000);
+    m = inflight[msg_type].msgs[inflight[msg_type].head++ %
+        FF_IPC_MAX_INFLIGHT];
+    if (ff_ipc_wait(m) < 0) {
+        return -1;
     }
 
-    return ret;
+    *msg = m;
+
+    return 0;
 }
@@ -37,7 +37,13 @@ void ff_ipc_exit(void);
 struct ff_msg *ff_ipc_msg_alloc(void);
 int ff_ipc_msg_free(struct ff_msg *msg);
 
-int ff_ipc_send(const struct ff_msg *msg);
+/*
+ * Several requests may be in flight at once, also to different processes.
+ * ff_ipc_recv() returns the oldest request of msg_type sent by this tool
+ * once its owning process has completed it, so requests to all processes
+ * can be sent first and received afterwards.
+ */
+int ff_ipc_send(struct ff_msg *msg);
 int ff_ipc_recv(struct ff_msg **msg, enum FF_MSG_TYPE msg_type);
 
 #endif
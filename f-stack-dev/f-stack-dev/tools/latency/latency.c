@@ -0,0 +1,211 @@
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include "ff_ipc.h"
+
+static const char *type_names[FF_LATENCY_NUM] = {
+    [FF_LATENCY_LOOP] = "loop",
+    [FF_LATENCY_TIMER] = "timer",
+    [FF_LATENCY_RX] = "rx",
+    [FF_LATENCY_USER] = "user",
+    [FF_LATENCY_DISPATCH] = "dispatch",
+};
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999, 0.9999};
+
+void
+usage(void)
+{
+    printf("Usage:\n");
+    printf("  latency [-p <f-stack proc_id>] [-P <max proc_id>] "
+        "[-t type] [-r]\n");
+    printf("  latency [-p <f-stack proc_id>] [-P <max proc_id>] "
+        "[-t type] -R\n");
+    printf("  type: loop, timer, rx, user, dispatch\n");
+}
+
+int
+latency_ctl(struct ff_latency_args *latency, struct ff_latency_hist *hist)
+{
+    int            ret;
+    struct ff_msg *msg, *retmsg = NULL;
+
+    msg = ff_ipc_msg_alloc();
+    if (msg == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    msg->msg_type = FF_LATENCY;
+    msg->latency = *latency;
+    ret = ff_ipc_send(msg);
+    if (ret < 0) {
+        errno = EPIPE;
+        ff_ipc_msg_free(msg);
+        return -1;
+    }
+
+    do {
+        if (retmsg != NULL) {
+            ff_ipc_msg_free(retmsg);
+        }
+
+        ret = ff_ipc_recv(&retmsg, msg->msg_type);
+        if (ret < 0) {
+            errno = EPIPE;
+            return -1;
+        }
+    } while (msg != retmsg);
+
+    if (retmsg->result != 0) {
+        errno = retmsg->result;
+        ret = -1;
+    } else {
+        *latency = retmsg->latency;
+        if (latency->cmd == FF_LATENCY_CMD_GET) {
+            memcpy(hist, retmsg->latency.hist, sizeof(*hist));
+        }
+    }
+
+    ff_ipc_msg_free(msg);
+
+    return ret;
+}
+
+/* Upper bound of the bucket holding the q quantile, at most the max */
+static uint64_t
+percentile(const struct ff_latency_hist *hist, double q)
+{
+    uint64_t rank, seen = 0, high;
+    unsigned b;
+
+    rank = q * hist->count;
+    if (rank < q * hist->count || rank == 0)
+        rank++;
+
+    for (b = 0; b < FF_LATENCY_BUCKETS - 1; b++) {
+        seen += hist->buckets[b];
+        if (seen >= rank) {
+            high = ff_latency_bucket_low(b + 1) - 1;
+            return high < hist->max ? high : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+static double
+to_us(uint64_t tsc, uint64_t hz)
+{
+    return (double)tsc * 1000000 / hz;
+}
+
+static void
+print_hist(int proc_id, int type, const struct ff_latency_hist *hist,
+    uint64_t hz)
+{
+    unsigned i;
+
+    printf("|%9d|%9s|%14lu|%11.2f|", proc_id, type_names[type], hist->count,
+        hist->count ? to_us(hist->sum / hist->count, hz) : 0.0);
+    for (i = 0; i < RTE_DIM(quantiles); i++) {
+        printf("%11.2f|", hist->count ? to_us(percentile(hist, quantiles[i]),
+            hz) : 0.0);
+    }
+    printf("%11.2f|\n", to_us(hist->max, hz));
+}
+
+int main(int argc, char **argv)
+{
+    int ch, i, j, type = -1, reset = 0, reset_only = 0, warned = 0;
+    int proc_id = 0, max_proc_id = -1;
+    struct ff_latency_args latency;
+    struct ff_latency_hist hist;
+
+    ff_ipc_init();
+
+    while ((ch = getopt(argc, argv, "hp:P:t:rR")) != -1) {
+        switch(ch) {
+        case 'p':
+            proc_id = atoi(optarg);
+            ff_set_proc_id(proc_id);
+            break;
+        case 'P':
+            max_proc_id = atoi(optarg);
+            break;
+        case 't':
+            for (type = 0; type < FF_LATENCY_NUM; type++) {
+                if (strcasecmp(optarg, type_names[type]) == 0)
+                    break;
+            }
+            if (type == FF_LATENCY_NUM) {
+                usage();
+                ff_ipc_exit();
+                return -1;
+            }
+            break;
+        case 'r':
+            reset = 1;
+            break;
+        case 'R':
+            reset_only = 1;
+            break;
+        case 'h':
+        default:
+            usage();
+            ff_ipc_exit();
+            return -1;
+        }
+    }
+
+    if (max_proc_id == -1)
+        max_proc_id = proc_id;
+
+    if (!reset_only) {
+        printf("|---------|---------|--------------|-----------|"
+            "-----------|-----------|-----------|-----------|"
+            "-----------|-----------|\n");
+        printf("|%9s|%9s|%14s|%11s|%11s|%11s|%11s|%11s|%11s|%11s|\n",
+            "proc_id", "type", "count", "avg(us)", "p50(us)", "p90(us)",
+            "p99(us)", "p99.9(us)", "p99.99(us)", "max(us)");
+        printf("|---------|---------|--------------|-----------|"
+            "-----------|-----------|-----------|-----------|"
+            "-----------|-----------|\n");
+    }
+
+    for (j = proc_id; j <= max_proc_id; j++) {
+        ff_set_proc_id(j);
+
+        for (i = 0; i < FF_LATENCY_NUM; i++) {
+            if (type != -1 && i != type)
+                continue;
+
+            memset(&latency, 0, sizeof(latency));
+            latency.cmd = reset_only ? FF_LATENCY_CMD_RESET :
+                FF_LATENCY_CMD_GET;
+            latency.type = reset_only ? type : i;
+            latency.reset = reset;
+
+            if (latency_ctl(&latency, &hist)) {
+                printf("fstack ipc message error, proc id:%d, %s!\n",
+                    j, strerror(errno));
+                ff_ipc_exit();
+                return -1;
+            }
+
+            if (!latency.enabled && !warned) {
+                printf("latency_hist is disabled in config.ini\n");
+                warned = 1;
+            }
+
+            /* one message resets all of a process's histograms */
+            if (reset_only)
+                break;
+
+            print_hist(j, i, &hist, latency.tsc_hz);
+        }
+    }
+
+    ff_ipc_exit();
+    return 0;
+}
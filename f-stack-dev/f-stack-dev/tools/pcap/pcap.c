@@ -0,0 +1,239 @@
+/* rte_bpf_convert() is still experimental in this dpdk */
+#define ALLOW_EXPERIMENTAL_API
+
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <pcap/pcap.h>
+#include <rte_errno.h>
+#include <rte_malloc.h>
+#include <rte_bpf.h>
+#include "ff_ipc.h"
+
+void
+usage(void)
+{
+    printf("Usage:\n");
+    printf("  pcap [-p <f-stack proc_id>] [-P <max proc_id>] "
+        "[-d in/out/inout] [-s snaplen] [-c count] start [filter ...]\n");
+    printf("  pcap [-p <f-stack proc_id>] [-P <max proc_id>] stop\n");
+    printf("  pcap [-p <f-stack proc_id>] [-P <max proc_id>] status\n");
+}
+
+/* Compile a pcap filter expression to the eBPF the stack runs */
+struct rte_bpf_prm *
+compile_filter(const char *expr, int snaplen)
+{
+    struct bpf_program bf;
+    struct rte_bpf_prm *prm;
+    pcap_t *pcap;
+
+    pcap = pcap_open_dead(DLT_EN10MB, snaplen);
+    if (pcap == NULL) {
+        printf("pcap_open_dead failed\n");
+        return NULL;
+    }
+
+    if (pcap_compile(pcap, &bf, expr, 1, PCAP_NETMASK_UNKNOWN) != 0) {
+        printf("invalid filter '%s': %s\n", expr, pcap_geterr(pcap));
+        pcap_close(pcap);
+        return NULL;
+    }
+
+    prm = rte_bpf_convert(&bf);
+    if (prm == NULL) {
+        printf("filter conversion failed: %s\n", rte_strerror(rte_errno));
+    }
+
+    pcap_freecode(&bf);
+    pcap_close(pcap);
+
+    return prm;
+}
+
+int
+pcap_ctl(struct ff_pcap_args *pcap, const struct rte_bpf_prm *prm)
+{
+    int            ret;
+    struct ff_msg *msg, *retmsg = NULL;
+    size_t filter_size;
+
+    msg = ff_ipc_msg_alloc();
+    if (msg == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    msg->msg_type = FF_PCAP;
+    msg->pcap = *pcap;
+    msg->pcap.filter = NULL;
+    msg->pcap.filter_len = 0;
+    if (prm != NULL) {
+        filter_size = prm->nb_ins * sizeof(struct ebpf_insn);
+        if (filter_size > msg->buf_len) {
+            printf("filter too large: %u insns\n", prm->nb_ins);
+            ff_ipc_msg_free(msg);
+            errno = E2BIG;
+            return -1;
+        }
+        memcpy(msg->buf_addr, prm->ins, filter_size);
+        msg->pcap.filter = (struct ebpf_insn *)msg->buf_addr;
+        msg->pcap.filter_len = prm->nb_ins;
+    }
+
+    ret = ff_ipc_send(msg);
+    if (ret < 0) {
+        errno = EPIPE;
+        ff_ipc_msg_free(msg);
+        return -1;
+    }
+
+    do {
+        if (retmsg != NULL) {
+            ff_ipc_msg_free(retmsg);
+        }
+
+        ret = ff_ipc_recv(&retmsg, msg->msg_type);
+        if (ret < 0) {
+            errno = EPIPE;
+            return -1;
+        }
+    } while (msg != retmsg);
+
+    if (retmsg->result != 0) {
+        errno = retmsg->result;
+        ff_ipc_msg_free(msg);
+        return -1;
+    }
+
+    *pcap = retmsg->pcap;
+
+    ff_ipc_msg_free(msg);
+
+    return 0;
+}
+
+const char *
+direction_str(int direction)
+{
+    switch (direction & (FF_PCAP_DIR_IN | FF_PCAP_DIR_OUT)) {
+    case FF_PCAP_DIR_IN:
+        return "in";
+    case FF_PCAP_DIR_OUT:
+        return "out";
+    default:
+        return "inout";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int ch, i, j;
+    struct ff_pcap_args pcap = {
+        .direction = FF_PCAP_DIR_IN | FF_PCAP_DIR_OUT,
+    };
+    struct rte_bpf_prm *prm = NULL;
+    int proc_id = 0, max_proc_id = -1;
+    char filter[1024] = "";
+
+    ff_ipc_init();
+
+    while ((ch = getopt(argc, argv, "hp:P:d:s:c:")) != -1) {
+        switch(ch) {
+        case 'p':
+            proc_id = atoi(optarg);
+            ff_set_proc_id(proc_id);
+            break;
+        case 'P':
+            max_proc_id = atoi(optarg);
+            if (max_proc_id < 0 || max_proc_id >= RTE_MAX_LCORE) {
+                usage();
+                ff_ipc_exit();
+                return -1;
+            }
+            break;
+        case 'd':
+            if (strcasecmp(optarg, "in") == 0)
+                pcap.direction = FF_PCAP_DIR_IN;
+            else if (strcasecmp(optarg, "out") == 0)
+                pcap.direction = FF_PCAP_DIR_OUT;
+            else if (strcasecmp(optarg, "inout") == 0)
+                pcap.direction = FF_PCAP_DIR_IN | FF_PCAP_DIR_OUT;
+            else {
+                usage();
+                ff_ipc_exit();
+                return -1;
+            }
+            break;
+        case 's':
+            pcap.snap_len = atoi(optarg);
+            break;
+        case 'c':
+            pcap.max_pkts = strtoull(optarg, NULL, 10);
+            break;
+        case 'h':
+        default:
+            usage();
+            ff_ipc_exit();
+            return -1;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if (argc < 1) {
+        usage();
+        ff_ipc_exit();
+        return -1;
+    }
+
+    if (strcasecmp(argv[0], "start") == 0) {
+        pcap.cmd = FF_PCAP_CMD_START;
+        for (i = 1; i < argc; i++) {
+            if (i > 1)
+                strncat(filter, " ", sizeof(filter) - strlen(filter) - 1);
+            strncat(filter, argv[i], sizeof(filter) - strlen(filter) - 1);
+        }
+        if (filter[0] != '\0') {
+            prm = compile_filter(filter, pcap.snap_len ? pcap.snap_len : 65535);
+            if (prm == NULL) {
+                ff_ipc_exit();
+                return -1;
+            }
+        }
+    } else if (strcasecmp(argv[0], "stop") == 0) {
+        pcap.cmd = FF_PCAP_CMD_STOP;
+    } else if (strcasecmp(argv[0], "status") == 0) {
+        pcap.cmd = FF_PCAP_CMD_STATUS;
+    } else {
+        usage();
+        ff_ipc_exit();
+        return -1;
+    }
+
+    if (max_proc_id == -1) {
+        max_proc_id = proc_id;
+    }
+
+    printf("|%9s|%8s|%6s|%8s|%20s|%20s|%20s|\n", "proc_id", "running",
+        "dir", "snaplen", "captured", "filtered", "drops");
+    for (j = proc_id; j <= max_proc_id; j++) {
+        struct ff_pcap_args args = pcap;
+
+        ff_set_proc_id(j);
+        if (pcap_ctl(&args, prm)) {
+            printf("fstack ipc message error, proc id:%d, %s\n", j,
+                strerror(errno));
+            continue;
+        }
+
+        printf("|%9d|%8s|%6s|%8u|%20lu|%20lu|%20lu|\n", j,
+            args.running ? "yes" : "no", direction_str(args.direction),
+            args.snap_len, args.captured, args.filtered, args.drops);
+    }
+
+    rte_free(prm);
+    ff_ipc_exit();
+    return 0;
+}
@@ -0,0 +1,12 @@
+# Probes for what the pcap tool needs: libpcap for pcap_compile(), and a
+# dpdk built with libpcap, which is the only case rte_bpf_convert() exists.
+
+PKGCONF ?= pkg-config
+
+FF_HAVE_LIBPCAP:= $(shell $(PKGCONF) --exists libpcap && echo 1)
+FF_HAVE_BPF_CONVERT:= $(shell printf '\043ifndef RTE_HAS_LIBPCAP\n\043error\n\043endif\n' | \
+	$(CC) -E $(shell $(PKGCONF) --cflags libdpdk 2>/dev/null) - >/dev/null 2>&1 && echo 1)
+
+ifeq ($(FF_HAVE_LIBPCAP)$(FF_HAVE_BPF_CONVERT),11)
+FF_HAVE_PCAP:= 1
+endif
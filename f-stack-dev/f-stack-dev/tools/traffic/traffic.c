@@ -6,7 +6,23 @@ usage(void)
 {
     printf("Usage:\n");
     printf("  top [-p <f-stack proc_id>] [-P <max proc_id>] "
-        "[-d <secs>] [-n num] [-s]\n");
+        "[-d <secs>] [-n num] [-s] [-D]\n");
+}
+
+/* Packets dispatched by one process to each queue since it started */
+void
+dispatch_status(int proc_id, struct ff_traffic_args *traffic)
+{
+    int q;
+
+    for (q = 0; q < FF_MAX_DISPATCH_QUEUES; q++) {
+        if (traffic->dispatch_packets[q] == 0 &&
+            traffic->dispatch_drops[q] == 0)
+            continue;
+
+        printf("|%9d|%9d|%20lu|%20lu|\n", proc_id, q,
+            traffic->dispatch_packets[q], traffic->dispatch_drops[q]);
+    }
 }
 
 int traffic_status(struct ff_traffic_args *traffic)
@@ -47,13 +63,57 @@ int traffic_status(struct ff_traffic_args *traffic)
     return 0;
 }
 
+/*
+ * Query processes first..last with all requests in flight at once, so a
+ * round costs about one main loop iteration instead of one per process.
+ */
+int traffic_status_procs(int first, int last, struct ff_traffic_args *ptraffic)
+{
+    int            j, sent, ret = 0;
+    struct ff_msg *msgs[RTE_MAX_LCORE], *retmsg;
+
+    for (j = first; j <= last; j++) {
+        msgs[j] = ff_ipc_msg_alloc();
+        if (msgs[j] == NULL) {
+            errno = ENOMEM;
+            ret = -1;
+            break;
+        }
+
+        msgs[j]->msg_type = FF_TRAFFIC;
+        ff_set_proc_id(j);
+        if (ff_ipc_send(msgs[j]) < 0) {
+            ff_ipc_msg_free(msgs[j]);
+            errno = EPIPE;
+            ret = -1;
+            break;
+        }
+    }
+    sent = j;
+
+    /* replies are received in send order */
+    for (j = first; j < sent; j++) {
+        if (ff_ipc_recv(&retmsg, FF_TRAFFIC) < 0) {
+            errno = EPIPE;
+            ret = -1;
+        } else {
+            ptraffic[j] = retmsg->traffic;
+        }
+
+        ff_ipc_msg_free(msgs[j]);
+    }
+
+    return ret;
+}
+
 int main(int argc, char **argv)
 {
     int ch, delay = 1, n = 0;
-    int single = 0;
+    int single = 0, dispatch = 0;
     unsigned int i, j;
     struct ff_traffic_args traffic = {0, 0, 0, 0}, otr;
-    struct ff_traffic_args ptraffic[RTE_MAX_LCORE], potr[RTE_MAX_LCORE];
+    /* large with the dispatch counters, keep them off the stack */
+    static struct ff_traffic_args ptraffic[RTE_MAX_LCORE], potr[RTE_MAX_LCORE];
     int proc_id = 0, max_proc_id = -1;
     uint64_t rxp, rxb, txp, txb;
     uint64_t prxp, prxb, ptxp, ptxb;
@@ -65,7 +125,7 @@ int main(int argc, char **argv)
 #define DIFF_P(member) (ptraffic[j].member - potr[j].member)
 #define ADD_S(member) (traffic.member += ptraffic[j].member)
 
-    while ((ch = getopt(argc, argv, "hp:P:d:n:s")) != -1) {
+    while ((ch = getopt(argc, argv, "hp:P:d:n:sD")) != -1) {
         switch(ch) {
         case 'p':
             proc_id = atoi(optarg);
@@ -90,6 +150,9 @@ int main(int argc, char **argv)
         case 's':
             single = 1;
             break;
+        case 'D':
+            dispatch = 1;
+            break;
         case 'h':
         default:
             usage();
@@ -98,6 +161,28 @@ int main(int argc, char **argv)
         }
     }
 
+    if (dispatch) {
+        if (max_proc_id == -1)
+            max_proc_id = proc_id;
+
+        printf("|---------|---------|--------------------|"
+            "--------------------|\n");
+        printf("|%9s|%9s|%20s|%20s|\n", "proc_id", "to queue",
+            "dispatched", "ring full drops");
+        printf("|---------|---------|--------------------|"
+            "--------------------|\n");
+        if (traffic_status_procs(proc_id, max_proc_id, ptraffic)) {
+            printf("fstack ipc message error !\n");
+            ff_ipc_exit();
+            return -1;
+        }
+        for (j = proc_id; j <= max_proc_id; j++) {
+            dispatch_status(j, &ptraffic[j]);
+        }
+        ff_ipc_exit();
+        return 0;
+    }
+
     if (single) {
         if (max_proc_id == -1) {
             if (traffic_status(&traffic)) {
@@ -109,14 +194,13 @@ int main(int argc, char **argv)
             printf("%lu,%lu,%lu,%lu\n", traffic.rx_packets, traffic.rx_bytes,
                 traffic.tx_packets, traffic.tx_bytes);
         } else {
-            for (j = proc_id; j <= max_proc_id; j++) {
-                ff_set_proc_id(j);
-                if (traffic_status(&ptraffic[j])) {
-                    printf("fstack ipc message error, proc id:%d!\n", j);
-                    ff_ipc_exit();
-                    return -1;
-                }
+            if (traffic_status_procs(proc_id, max_proc_id, ptraffic)) {
+                printf("fstack ipc message error !\n");
+                ff_ipc_exit();
+                return -1;
+            }
 
+            for (j = proc_id; j <= max_proc_id; j++) {
                 printf("%9d,%20lu,%20lu,%20lu,%20lu,\n",
                     j, ptraffic[j].rx_packets, ptraffic[j].rx_bytes,
                     ptraffic[j].tx_packets, ptraffic[j].tx_bytes);
@@ -177,14 +261,15 @@ int main(int argc, char **argv)
             rxp = rxb = txp = txb = 0;
             for (j = proc_id; j <= max_proc_id; j++) {
                 potr[j] = ptraffic[j];
+            }
 
-                ff_set_proc_id(j);
-                if (traffic_status(&ptraffic[j])) {
-                    printf("fstack ipc message error, proc id:%d!\n", j);
-                    ff_ipc_exit();
-                    return -1;
-                }
+            if (traffic_status_procs(proc_id, max_proc_id, ptraffic)) {
+                printf("fstack ipc message error !\n");
+                ff_ipc_exit();
+                return -1;
+            }
 
+            for (j = proc_id; j <= max_proc_id; j++) {
                 if (i) {
                     prxp = DIFF_P(rx_packets);
                     prxb = DIFF_P(rx_bytes);
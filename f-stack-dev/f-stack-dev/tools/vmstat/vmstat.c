@@ -0,0 +1,140 @@
+#include <unistd.h>
+#include <string.h>
+#include <sys/sysctl.h>
+#include <memstat.h>
+#include "ff_ipc.h"
+
+#define MAX_MALLOC_ZONES 32
+
+void
+usage(void)
+{
+    printf("Usage:\n");
+    printf("  vmstat [-p <f-stack proc_id>] -m\n");
+    printf("  vmstat [-p <f-stack proc_id>] -z\n");
+}
+
+/* malloc(9) usage per type, as vmstat -m */
+static int
+show_malloc(void)
+{
+    struct memory_type_list *mtlp;
+    struct memory_type *mtp;
+    int sizes[MAX_MALLOC_ZONES];
+    size_t len = sizeof(sizes);
+    int i, nzones, first;
+
+    if (sysctlbyname("vm.malloc.zone_sizes", sizes, &len, NULL, 0) < 0) {
+        printf("sysctl vm.malloc.zone_sizes: %s\n", strerror(errno));
+        return -1;
+    }
+    nzones = len / sizeof(sizes[0]);
+
+    mtlp = memstat_mtl_alloc();
+    if (mtlp == NULL) {
+        printf("memstat_mtl_alloc failed\n");
+        return -1;
+    }
+    if (memstat_sysctl_malloc(mtlp, 0) < 0) {
+        printf("memstat_sysctl_malloc: %s\n",
+            memstat_strerror(memstat_mtl_geterror(mtlp)));
+        memstat_mtl_free(mtlp);
+        return -1;
+    }
+
+    printf("%16s %8s %8s %12s  %s\n", "Type", "InUse", "MemUse",
+        "Requests", "Size(s)");
+    for (mtp = memstat_mtl_first(mtlp); mtp != NULL;
+        mtp = memstat_mtl_next(mtp)) {
+        if (memstat_get_numallocs(mtp) == 0 &&
+            memstat_get_count(mtp) == 0)
+            continue;
+
+        printf("%16s %8lu %7luK %12lu  ", memstat_get_name(mtp),
+            memstat_get_count(mtp), (memstat_get_bytes(mtp) + 1023) / 1024,
+            memstat_get_numallocs(mtp));
+        first = 1;
+        for (i = 0; i < nzones && sizes[i] != 0; i++) {
+            if (memstat_get_sizemask(mtp) & (1 << i)) {
+                printf("%s%d", first ? "" : ",", sizes[i]);
+                first = 0;
+            }
+        }
+        printf("%s\n", first ? "large" : "");
+    }
+
+    memstat_mtl_free(mtlp);
+    return 0;
+}
+
+/* uma(9) usage per zone, as vmstat -z */
+static int
+show_zone(void)
+{
+    struct memory_type_list *mtlp;
+    struct memory_type *mtp;
+
+    mtlp = memstat_mtl_alloc();
+    if (mtlp == NULL) {
+        printf("memstat_mtl_alloc failed\n");
+        return -1;
+    }
+    if (memstat_sysctl_uma(mtlp, 0) < 0) {
+        printf("memstat_sysctl_uma: %s\n",
+            memstat_strerror(memstat_mtl_geterror(mtlp)));
+        memstat_mtl_free(mtlp);
+        return -1;
+    }
+
+    printf("%-19s %6s %8s %8s %8s %12s %6s\n", "ITEM", "SIZE", "LIMIT",
+        "USED", "FREE", "REQ", "FAIL");
+    for (mtp = memstat_mtl_first(mtlp); mtp != NULL;
+        mtp = memstat_mtl_next(mtp)) {
+        printf("%-19s %6lu %8lu %8lu %8lu %12lu %6lu\n",
+            memstat_get_name(mtp), memstat_get_size(mtp),
+            memstat_get_countlimit(mtp), memstat_get_count(mtp),
+            memstat_get_free(mtp), memstat_get_numallocs(mtp),
+            memstat_get_failures(mtp));
+    }
+
+    memstat_mtl_free(mtlp);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int ch, ret, mflag = 0, zflag = 0;
+
+    ff_ipc_init();
+
+    while ((ch = getopt(argc, argv, "hp:mz")) != -1) {
+        switch(ch) {
+        case 'p':
+            ff_set_proc_id(atoi(optarg));
+            break;
+        case 'm':
+            mflag = 1;
+            break;
+        case 'z':
+            zflag = 1;
+            break;
+        case 'h':
+        default:
+            usage();
+            ff_ipc_exit();
+            return -1;
+        }
+    }
+
+    if (mflag == zflag) {
+        usage();
+        ff_ipc_exit();
+        return -1;
+    }
+
+    ret = mflag ? show_malloc() : show_zone();
+
+    ff_ipc_exit();
+
+    return ret;
+}